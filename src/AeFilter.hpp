@@ -1,9 +1,11 @@
 #include <math.h>
+#include <vector>
 #include "dsp/frame.hpp"
 
 enum AeFilterType {
     AeLOWPASS,
-    AeHIGHPASS
+    AeHIGHPASS,
+    AeBANDPASS
 };
 
 enum AeEQType {
@@ -12,14 +14,30 @@ enum AeEQType {
     AePEAKINGEQ
 };
 
+/* flush tiny values to zero so the recursive filter state never decays into
+   denormals (which are extremely slow on most CPUs) */
+inline float aeFlushDenormal(float x) {
+    return (fabsf(x) < 1e-15f) ? 0.0f : x;
+}
+
 struct AeFilter {
     float x[2] = {0.0f};
     float y[2] =  {0.0f};
 
     float a0, a1, a2, b0, b1, b2;
 
+    void init() {
+	x[0] = x[1] = 0.0f;
+	y[0] = y[1] = 0.0f;
+    }
+
+    //true if the filter would output (almost) nothing for zero input
+    bool isSilent(float threshold) {
+	return fabsf(x[0]) < threshold && fabsf(x[1]) < threshold && fabsf(y[0]) < threshold && fabsf(y[1]) < threshold;
+    }
+
     float process(float in) {
-	float out = b0 * in + b1 * x[0] + b2 * x[1] - a1 * y[0] - a2 * y[1];
+	float out = aeFlushDenormal(b0 * in + b1 * x[0] + b2 * x[1] - a1 * y[0] - a2 * y[1]);
 
 	//shift buffers
 	x[1] = x[0];
@@ -53,6 +71,14 @@ struct AeFilter {
 	    b2 = (1 + cs0) /2 /a0;
 	    a1 = -2 * cs0 /a0;
 	    a2 = (1 - alpha) /a0;
+	    break;
+	case AeBANDPASS:
+	    a0 = 1 + alpha;
+	    b0 = alpha /a0;
+	    b1 = 0.0f;
+	    b2 = -alpha /a0;
+	    a1 = -2 * cs0 /a0;
+	    a2 = (1 - alpha) /a0;
 	}
     }
 };
@@ -80,7 +106,7 @@ struct AeFilterFrame : AeFilter {
     Frame<CHANNELS> process(Frame<CHANNELS> in) {
 	Frame<CHANNELS> out;
 	for(int i=0;i<channels;i++) {
-	    out.samples[i] = b0 * in.samples[i] + b1 * x[0].samples[i] + b2 * x[1].samples[i] - a1 * y[0].samples[i] - a2 * y[1].samples[i];
+	    out.samples[i] = aeFlushDenormal(b0 * in.samples[i] + b1 * x[0].samples[i] + b2 * x[1].samples[i] - a1 * y[0].samples[i] - a2 * y[1].samples[i]);
 	}
 
 	//shift buffers
@@ -99,8 +125,8 @@ struct AeFilterStereo : AeFilter {
     float yr[2] = {0.0f};
 
     void process(float* inL, float* inR) {
-	float l = b0 * *inL + b1 * xl[0] + b2 * xl[1] - a1 * yl[0] - a2 * yl[1];
-	float r = b0 * *inR + b1 * xr[0] + b2 * xr[1] - a1 * yr[0] - a2 * yr[1];
+	float l = aeFlushDenormal(b0 * *inL + b1 * xl[0] + b2 * xl[1] - a1 * yl[0] - a2 * yl[1]);
+	float r = aeFlushDenormal(b0 * *inR + b1 * xr[0] + b2 * xr[1] - a1 * yr[0] - a2 * yr[1]);
 
 	//shift buffers
 	xl[1] = xl[0];
@@ -118,14 +144,36 @@ struct AeFilterStereo : AeFilter {
     }
 };
 
+struct AeEQCoefficients {
+    float a1, a2, b0, b1, b2;
+};
+
 struct AeEqualizer {
     float x[2] = {0.0f};
     float y[2] = {0.0f};
 
     float a0, a1, a2, b0, b1, b2;
 
+    void init() {
+	x[0] = x[1] = 0.0f;
+	y[0] = y[1] = 0.0f;
+    }
+
+    //true if the filter would output (almost) nothing for zero input
+    bool isSilent(float threshold) {
+	return fabsf(x[0]) < threshold && fabsf(x[1]) < threshold && fabsf(y[0]) < threshold && fabsf(y[1]) < threshold;
+    }
+
+    void setParams(const AeEQCoefficients &c) {
+	a1 = c.a1;
+	a2 = c.a2;
+	b0 = c.b0;
+	b1 = c.b1;
+	b2 = c.b2;
+    }
+
     float process(float in) {
-	float out = b0 * in + b1 * x[0] + b2 * x[1] - a1 * y[0] - a2 * y[1];
+	float out = aeFlushDenormal(b0 * in + b1 * x[0] + b2 * x[1] - a1 * y[0] - a2 * y[1]);
 	//shift buffers
 	x[1] = x[0];
 	x[0] = in;
@@ -172,6 +220,78 @@ struct AeEqualizer {
     }
 };
 
+/* Coefficients for one EQ band with fixed frequency and q, precomputed over
+   the gain range in steps of GAIN_STEP dB. Call generate() again when the
+   samplerate changes */
+struct AeEqualizerTable {
+    const float GAIN_STEP = 0.05f;
+
+    float f = 1000.0f;
+    float q = 0.7f;
+    float minGain = 0.0f;
+    float maxGain = 0.0f;
+    AeEQType type = AePEAKINGEQ;
+    std::vector<AeEQCoefficients> coefficients;
+
+    void init(float f, float q, float minGain, float maxGain, AeEQType type) {
+	this->f = f;
+	this->q = q;
+	this->minGain = minGain;
+	this->maxGain = maxGain;
+	this->type = type;
+	generate();
+    }
+
+    void generate() {
+	int size = (int)roundf((maxGain - minGain) / GAIN_STEP) + 1;
+	coefficients.resize(size);
+
+	AeEqualizer eq;
+	for(int i=0;i<size;i++) {
+	    eq.setParams(f, q, minGain + i * GAIN_STEP, type);
+	    coefficients[i].a1 = eq.a1;
+	    coefficients[i].a2 = eq.a2;
+	    coefficients[i].b0 = eq.b0;
+	    coefficients[i].b1 = eq.b1;
+	    coefficients[i].b2 = eq.b2;
+	}
+    }
+
+    //gains that map to the 0 dB entry, i.e. an identity filter
+    bool isFlat(float gaindb) const {
+	return fabsf(gaindb) < 0.5f * GAIN_STEP;
+    }
+
+    const AeEQCoefficients &lookup(float gaindb) const {
+	int index = clamp((int)roundf((gaindb - minGain) / GAIN_STEP), 0, (int)coefficients.size() - 1);
+	return coefficients[index];
+    }
+};
+
+/* An AeEqualizerTable shared by all modules that use the same band. The
+   coefficients only depend on the samplerate, so update() regenerates them
+   once after a change and is a no-op for every later caller. Call it from
+   the module constructor and onSampleRateChange(), Rack holds the engine
+   lock during the latter so no module reads the table meanwhile */
+struct AeSharedEqualizerTable : AeEqualizerTable {
+    float sampleRate = 0.0f;
+
+    AeSharedEqualizerTable(float f, float q, float minGain, float maxGain, AeEQType type) {
+	this->f = f;
+	this->q = q;
+	this->minGain = minGain;
+	this->maxGain = maxGain;
+	this->type = type;
+    }
+
+    void update() {
+	if(sampleRate != engineGetSampleRate()) {
+	    sampleRate = engineGetSampleRate();
+	    generate();
+	}
+    }
+};
+
 struct AeEqualizerStereo : AeEqualizer {
     float xl[2] = {0.0f};
     float xr[2] = {0.0f};
@@ -179,8 +299,8 @@ struct AeEqualizerStereo : AeEqualizer {
     float yr[2] = {0.0f};
 
     void process(float* inL, float* inR) {
-	float l = b0 * *inL + b1 * xl[0] + b2 * xl[1] - a1 * yl[0] - a2 * yl[1];
-	float r = b0 * *inR + b1 * xr[0] + b2 * xr[1] - a1 * yr[0] - a2 * yr[1];
+	float l = aeFlushDenormal(b0 * *inL + b1 * xl[0] + b2 * xl[1] - a1 * yl[0] - a2 * yl[1]);
+	float r = aeFlushDenormal(b0 * *inR + b1 * xr[0] + b2 * xr[1] - a1 * yr[0] - a2 * yr[1]);
 
 	//shift buffers
 	xl[1] = xl[0];
@@ -197,3 +317,259 @@ struct AeEqualizerStereo : AeEqualizer {
 	*inR = r;
     }
 };
+
+/* tan(pi * x) for normalized frequencies x = f/fs in [0, 0.5).
+   Used for the frequency prewarping of the SVF, so a cutoff change costs one
+   table lookup instead of a trigonometric call */
+struct AeTanTable {
+    static const int SIZE = 1024;
+    //highest normalized frequency we allow (tan goes to infinity at 0.5)
+    const float MAX_FREQ = 0.49f;
+    float table[SIZE + 2];
+
+    AeTanTable() {
+	for(int i=0;i<=SIZE;i++) {
+	    table[i] = tan(M_PI * fminf(0.5f * i / SIZE, MAX_FREQ));
+	}
+	table[SIZE + 1] = table[SIZE];
+    }
+
+    float lookup(float x) {
+	float pos = clamp(x, 0.0f, MAX_FREQ) * 2.0f * SIZE;
+	int index = (int)pos;
+	float frac = pos - index;
+	return table[index] + frac * (table[index + 1] - table[index]);
+    }
+};
+
+inline float aeTan(float x) {
+    static AeTanTable tanTable;
+    return tanTable.lookup(x);
+}
+
+/* Zero-delay-feedback (TPT) state variable filter.
+   Unlike the biquads above this stays stable under audio-rate cutoff
+   modulation and coefficient updates are cheap, so setCutoff can be called
+   every sample */
+struct AeSVF {
+    float ic1eq = 0.0f;
+    float ic2eq = 0.0f;
+
+    float k = 1.0f;
+    float a1 = 0.0f;
+    float a2 = 0.0f;
+    float a3 = 0.0f;
+    int type = AeLOWPASS;
+
+    void setCutoff(float f, float q, int type) {
+	float g = aeTan(f / engineGetSampleRate());
+	k = 1.0f / q;
+	a1 = 1.0f / (1.0f + g * (g + k));
+	a2 = g * a1;
+	a3 = g * a2;
+	this->type = type;
+    }
+
+    float process(float in) {
+	float v3 = in - ic2eq;
+	float v1 = a1 * ic1eq + a2 * v3;
+	float v2 = ic2eq + a2 * ic1eq + a3 * v3;
+	ic1eq = aeFlushDenormal(2.0f * v1 - ic1eq);
+	ic2eq = aeFlushDenormal(2.0f * v2 - ic2eq);
+
+	switch(type) {
+	case AeHIGHPASS:
+	    return in - k * v1 - v2;
+	case AeBANDPASS:
+	    return v1;
+	default:
+	    return v2;
+	}
+    }
+};
+
+template<int CHANNELS>
+struct AeSVFFrame : AeSVF {
+    Frame<CHANNELS> ic1eq;
+    Frame<CHANNELS> ic2eq;
+
+    int channels = CHANNELS;
+
+    AeSVFFrame() {
+	init();
+    }
+
+    void init() {
+	for(int i=0;i<channels;i++) {
+	    ic1eq.samples[i] = 0.0f;
+	    ic2eq.samples[i] = 0.0f;
+	}
+    }
+
+    Frame<CHANNELS> process(Frame<CHANNELS> in) {
+	Frame<CHANNELS> out;
+	for(int i=0;i<channels;i++) {
+	    float v3 = in.samples[i] - ic2eq.samples[i];
+	    float v1 = a1 * ic1eq.samples[i] + a2 * v3;
+	    float v2 = ic2eq.samples[i] + a2 * ic1eq.samples[i] + a3 * v3;
+	    ic1eq.samples[i] = aeFlushDenormal(2.0f * v1 - ic1eq.samples[i]);
+	    ic2eq.samples[i] = aeFlushDenormal(2.0f * v2 - ic2eq.samples[i]);
+
+	    switch(type) {
+	    case AeHIGHPASS:
+		out.samples[i] = in.samples[i] - k * v1 - v2;
+		break;
+	    case AeBANDPASS:
+		out.samples[i] = v1;
+		break;
+	    default:
+		out.samples[i] = v2;
+	    }
+	}
+	return out;
+    }
+};
+
+/* N independent biquads stored as structure of arrays. All lanes are
+   processed in one loop without dependencies between them, so the compiler
+   can vectorize it (keep N a multiple of 4). Unused lanes pass their (zero)
+   input through */
+template<int N>
+struct AeBiquadBank {
+    float b0[N], b1[N], b2[N], a1[N], a2[N];
+    float x1[N], x2[N], y1[N], y2[N];
+
+    AeBiquadBank() {
+	for(int i=0;i<N;i++) {
+	    b0[i] = 1.0f;
+	    b1[i] = b2[i] = a1[i] = a2[i] = 0.0f;
+	}
+	init();
+    }
+
+    void init() {
+	for(int i=0;i<N;i++) {
+	    init(i);
+	}
+    }
+
+    void init(int lane) {
+	x1[lane] = x2[lane] = 0.0f;
+	y1[lane] = y2[lane] = 0.0f;
+    }
+
+    //copy coefficients from anything that has a1, a2, b0, b1, b2 (AeFilter, AeEqualizer, AeEQCoefficients)
+    template<typename T>
+    void setCoefficients(int lane, const T &c) {
+	a1[lane] = c.a1;
+	a2[lane] = c.a2;
+	b0[lane] = c.b0;
+	b1[lane] = c.b1;
+	b2[lane] = c.b2;
+    }
+
+    bool isSilent(int lane, float threshold) {
+	return fabsf(x1[lane]) < threshold && fabsf(x2[lane]) < threshold && fabsf(y1[lane]) < threshold && fabsf(y2[lane]) < threshold;
+    }
+
+    //filter all lanes in place
+    void process(float *in) {
+	for(int i=0;i<N;i++) {
+	    float out = aeFlushDenormal(b0[i] * in[i] + b1[i] * x1[i] + b2[i] * x2[i] - a1[i] * y1[i] - a2[i] * y2[i]);
+	    x2[i] = x1[i];
+	    x1[i] = in[i];
+	    y2[i] = y1[i];
+	    y1[i] = out;
+	    in[i] = out;
+	}
+    }
+};
+
+/* One EQ band for N lanes with coefficients from a gain table. Lanes at 0 dB
+   are identity filters, so the whole bank is skipped while all lanes in use
+   are flat. The history is still shifted in that case (with the output equal
+   to the input), so the filter restarts without a click and stale output
+   history doesn't keep the lane from going silent */
+template<int N>
+struct AeEqualizerBank : AeBiquadBank<N> {
+    //shared, see AeSharedEqualizerTable
+    const AeEqualizerTable *table = nullptr;
+    //bit i is set if lane i is not flat
+    int nonFlatMask = 0;
+
+    void setGain(int lane, float gaindb) {
+	this->setCoefficients(lane, table->lookup(gaindb));
+	if(table->isFlat(gaindb))
+	    nonFlatMask &= ~(1 << lane);
+	else
+	    nonFlatMask |= 1 << lane;
+    }
+
+    //laneMask: lanes that carry signal
+    void process(float *in, int laneMask) {
+	if(!(nonFlatMask & laneMask)) {
+	    //output of an identity filter equals its input
+	    for(int i=0;i<N;i++) {
+		this->x2[i] = this->y2[i] = this->x1[i];
+		this->x1[i] = this->y1[i] = in[i];
+	    }
+	    return;
+	}
+	AeBiquadBank<N>::process(in);
+    }
+};
+
+/* Two fixed biquads in series with the same coefficients for every lane
+   (like the Mixer's channel hp and high shelve). Both stages run in a single
+   pass and share the intermediate history */
+template<int N>
+struct AeBiquadPairBank {
+    AeEQCoefficients first;
+    AeEQCoefficients second;
+    //x: input, m: output of the first stage, y: output
+    float x1[N], x2[N], m1[N], m2[N], y1[N], y2[N];
+
+    AeBiquadPairBank() {
+	init();
+    }
+
+    void init() {
+	for(int i=0;i<N;i++) {
+	    init(i);
+	}
+    }
+
+    void init(int lane) {
+	x1[lane] = x2[lane] = 0.0f;
+	m1[lane] = m2[lane] = 0.0f;
+	y1[lane] = y2[lane] = 0.0f;
+    }
+
+    template<typename T, typename U>
+    void setCoefficients(const T &f, const U &g) {
+	first.a1 = f.a1; first.a2 = f.a2; first.b0 = f.b0; first.b1 = f.b1; first.b2 = f.b2;
+	second.a1 = g.a1; second.a2 = g.a2; second.b0 = g.b0; second.b1 = g.b1; second.b2 = g.b2;
+    }
+
+    bool isSilent(int lane, float threshold) {
+	return fabsf(x1[lane]) < threshold && fabsf(x2[lane]) < threshold && fabsf(m1[lane]) < threshold
+	    && fabsf(m2[lane]) < threshold && fabsf(y1[lane]) < threshold && fabsf(y2[lane]) < threshold;
+    }
+
+    //filter all lanes in place
+    void process(float *in) {
+	const AeEQCoefficients f = first;
+	const AeEQCoefficients g = second;
+	for(int i=0;i<N;i++) {
+	    float m = aeFlushDenormal(f.b0 * in[i] + f.b1 * x1[i] + f.b2 * x2[i] - f.a1 * m1[i] - f.a2 * m2[i]);
+	    float out = aeFlushDenormal(g.b0 * m + g.b1 * m1[i] + g.b2 * m2[i] - g.a1 * y1[i] - g.a2 * y2[i]);
+	    x2[i] = x1[i];
+	    x1[i] = in[i];
+	    m2[i] = m1[i];
+	    m1[i] = m;
+	    y2[i] = y1[i];
+	    y1[i] = out;
+	    in[i] = out;
+	}
+    }
+};
@@ -0,0 +1,48 @@
+#include <math.h>
+
+/* tanh approximation (7th order Lambert continued fraction), absolute error
+   below 1e-4 for all x. The input is clamped at +-4.97 where the fraction
+   reaches 1. Branch free, so loops over it vectorize */
+inline float aeTanh(float x) {
+    x = (x < -4.97f) ? -4.97f : x;
+    x = (x > 4.97f) ? 4.97f : x;
+    float x2 = x * x;
+    return x * (135135.0f + x2 * (17325.0f + x2 * (378.0f + x2))) / (135135.0f + x2 * (62370.0f + x2 * (3150.0f + 28.0f * x2)));
+}
+
+/* Multi-stage folding in closed form. Each stage reflects the signal at
+   +-t, so on piece p (between (2p-1)t and (2p+1)t) the folded signal is
+   (-1)^p * (x - 2pt). n stages fold the pieces up to +-n and leave
+   everything beyond on the outermost one. With a huge maxPiece this is the
+   single pass (alternative) fold. Branch free, so it vectorizes */
+
+//floorf without SSE4.1, for |x| <= 1e6
+inline float aeFoldFloor(float x) {
+    float r = (float)(int)x;
+    return (r > x) ? r - 1.0f : r;
+}
+
+inline float aeFoldPiece(float x, float t, float maxPiece) {
+    //maxPiece is an integer, so clamping before the floor is the same
+    float p = (x + t) * (0.5f / t);
+    p = (p < -maxPiece) ? -maxPiece : p;
+    p = (p > maxPiece) ? maxPiece : p;
+    return aeFoldFloor(p);
+}
+
+//+1 on even pieces, -1 on odd ones
+inline float aeFoldSlope(float p) {
+    return 1.0f - 2.0f * (p - 2.0f * aeFoldFloor(0.5f * p));
+}
+
+inline float aeFoldLinear(float x, float t, float maxPiece) {
+    float p = aeFoldPiece(x, t, maxPiece);
+    return aeFoldSlope(p) * (x - 2.0f * p * t);
+}
+
+//fold and saturate len samples in one vectorized pass
+inline void aeFoldBlock(float *x, int len, float t, float maxPiece) {
+    for(int i=0;i<len;i++) {
+	x[i] = aeTanh(aeFoldLinear(x[i], t, maxPiece));
+    }
+}
@@ -0,0 +1,98 @@
+#include "rack.hpp"
+
+/* playback directions shared by the sequencers */
+enum AePlaybackMode {
+    AE_FORWARD,
+    AE_BACKWARD,
+    AE_ALTERNATING,
+    AE_RANDOM_NEIGHBOUR,
+    AE_RANDOM,
+    AE_HOLD,
+    AE_NUM_PLAYBACK_MODES
+};
+
+//sets of modes for AeStepper
+#define AE_FORWARD_ONLY (1 << AE_FORWARD)
+#define AE_ALL_PLAYBACK_MODES ((1 << AE_NUM_PLAYBACK_MODES) - 1)
+
+/* Every mode moves a position on a ring of steps: direction is the sign of
+   the step, alternating runs on a ring of 2 * (numSteps - 1) positions that is
+   folded back onto the steps, random neighbour picks the sign at random and
+   random ignores the position. Direction 0 holds the step. */
+struct AeStepMode {
+    int direction;
+    bool alternating;
+    bool randomDirection;
+    bool random;
+};
+
+static constexpr AeStepMode aeStepModes[AE_NUM_PLAYBACK_MODES] = {
+    {1, false, false, false},
+    {-1, false, false, false},
+    {1, true, false, false},
+    {1, false, true, false},
+    {1, false, false, true},
+    {0, false, false, false}
+};
+
+/* Playback position of one sequencer channel. MODES is the set of supported
+   modes, other modes play forward. With AE_FORWARD_ONLY advance() is a plain
+   increment. */
+template<int MODES = AE_ALL_PLAYBACK_MODES>
+struct AeStepper {
+    //current step, -1 before the first step (the next advance() goes to the first step of the mode)
+    int index = 0;
+    //alternating mode: moving towards the last step
+    bool forward = true;
+
+    void reset(int i = 0) {
+	index = i;
+	forward = true;
+    }
+
+    /* Move stepsize steps (0 repeats the step, 2 skips one) and return the new index */
+    int advance(int mode, int numSteps, int stepsize = 1) {
+	if(MODES == AE_FORWARD_ONLY) {
+	    //needs stepsize >= 1 to leave index -1
+	    index = (index + stepsize) % numSteps;
+	    return index;
+	}
+
+	if(numSteps <= 1) {
+	    index = 0;
+	    return index;
+	}
+	if(mode < 0 || mode >= AE_NUM_PLAYBACK_MODES || !(MODES & (1 << mode)))
+	    mode = AE_FORWARD;
+	const AeStepMode &m = aeStepModes[mode];
+
+	if(m.direction == 0) {
+	    index = rack::clamp(index, 0, numSteps - 1);
+	    return index;
+	}
+	if(m.random) {
+	    index = std::min((int)(rack::randomUniform() * numSteps), numSteps - 1);
+	    return index;
+	}
+
+	int delta = m.direction * stepsize;
+	if(m.randomDirection && rack::randomUniform() > 0.5)
+	    delta = -delta;
+
+	int ring = m.alternating ? 2 * (numSteps - 1) : numSteps;
+	int pos;
+	if(index < 0) {
+	    //start at the first (or, backwards, the last) step, even when repeating
+	    delta = (delta == 0) ? m.direction : delta;
+	    pos = (delta < 0) ? 0 : -1;
+	}
+	else
+	    pos = (m.alternating && !forward) ? ring - index : index;
+
+	pos = (pos + delta) % ring;
+	pos = (pos < 0) ? pos + ring : pos;
+	forward = pos < numSteps - 1;
+	index = (pos < numSteps) ? pos : ring - pos;
+	return index;
+    }
+};
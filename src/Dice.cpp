@@ -1,5 +1,6 @@
 #include "aepelzen.hpp"
 #include "dsp/digital.hpp"
+#include "AeStepper.hpp"
 
 #define NUM_CHANNELS 4
 #define NUM_STEPS 8
@@ -28,14 +29,6 @@ struct Dice : Module {
 	NUM_LIGHTS = STEP_LIGHT + NUM_CHANNELS * NUM_STEPS
     };
 
-    enum PlaybackModes {
-	MODE_FORWARD,
-	MODE_BACKWARD,
-	MODE_ALTERNATING,
-	MODE_RANDOM_NEIGHBOUR,
-	MODE_RANDOM
-    };
-
     Dice() : Module(NUM_PARAMS, NUM_INPUTS, NUM_OUTPUTS, NUM_LIGHTS) {
 	//initialize RNG
 	//randomSeedTime();
@@ -46,8 +39,7 @@ struct Dice : Module {
     SchmittTrigger resetTrigger;
     PulseGenerator gatePulse[NUM_CHANNELS];
     SchmittTrigger clockTrigger;
-    int channel_index[NUM_CHANNELS] = {0};
-    bool direction[NUM_CHANNELS] = {};
+    AeStepper<> stepper[NUM_CHANNELS];
     float ColumnValue[NUM_CHANNELS] = {0};
     float randomValue;
 };
@@ -73,52 +65,20 @@ void Dice::step() {
 
 	if (channelStep) {
 	    int numSteps = clamp((int)roundf(params[CHANNEL_STEPS_PARAM + y].value), 1, 8);
-	    int mode = clamp((int)roundf(params[CHANNEL_MODE_PARAM + y].value),0,5);
+	    int mode = clamp((int)roundf(params[CHANNEL_MODE_PARAM + y].value), 0, AE_HOLD);
 	    gatePulse[y].trigger(1e-3);
 	    randomValue = randomUniform();
 	    
-	    if (mode == MODE_RANDOM_NEIGHBOUR) {
-		mode = (randomUniform() > 0.5) ? MODE_FORWARD : MODE_BACKWARD;
-	    }
-
-	    switch(mode) {
-	    case MODE_FORWARD:
-		channel_index[y] += 1;
-		channel_index[y] = (channel_index[y] >= numSteps) ? 0 : channel_index[y];
-		break;
-	    case MODE_BACKWARD:
-		channel_index[y] -= 1;
-		channel_index[y] = (channel_index[y] < 0) ? numSteps - 1 : channel_index[y];
-		break;
-	    case MODE_ALTERNATING:
-		if (direction[y]) {
-		    channel_index[y] += 1;
-		    if (channel_index[y] >= numSteps) {
-			channel_index[y] = numSteps - 2;
-			direction[y] = !direction[y];
-		    }
-		}
-		else {
-		    channel_index[y] -= 1;
-		    if (channel_index[y] <= 0) {
-			channel_index[y] = 0;
-			direction[y] = !direction[y];
-		    }
-		}
-		break;
-	    case MODE_RANDOM:
-		channel_index[y] = rand() % numSteps;
-		break;
-	    }	    
+	    stepper[y].advance(mode, numSteps);
 	}
 	
 	pulse = gatePulse[y].process(1.0 / engineGetSampleRate());
-	bool gateOn = (randomValue < (params[COLUMN1_PARAM + channel_index[y] + y * 8].value)) ? 1.0 : 0.0;
+	bool gateOn = (randomValue < (params[COLUMN1_PARAM + stepper[y].index + y * 8].value)) ? 1.0 : 0.0;
 	gateOn = gateOn && !pulse;
 	outputs[GATE_OUTPUT + y].value = (gateOn) ? 10.0 : 0.0;
 	
 	for(int i=0;i<NUM_STEPS;i++) {
-	    lights[STEP_LIGHT + y*NUM_STEPS + i].value = (i == channel_index[y] ? 1.0 : 0.0);   
+	    lights[STEP_LIGHT + y*NUM_STEPS + i].value = (i == stepper[y].index ? 1.0 : 0.0);   
 	}
     }
 
@@ -126,7 +86,7 @@ void Dice::step() {
     if (resetTrigger.process(params[RESET_PARAM].value)) {
 	//nextStep = true;
 	for (int i=0;i<NUM_CHANNELS;i++) {
-	    channel_index[i] = 0;
+	    stepper[i].reset();
 	}
     }
 }
@@ -154,7 +114,7 @@ DiceWidget::DiceWidget(Dice *module) : ModuleWidget(module) {
 	    addChild(ModuleLightWidget::create<SmallLight<RedLight>>(Vec(16 + y*27, 50 + i*28), module, Dice::STEP_LIGHT + y *NUM_STEPS + i));
 	}
 	addParam(ParamWidget::create<Trimpot>(Vec(10 + y*27, 265), module, Dice::CHANNEL_STEPS_PARAM + y, 1.0, 8.0, 8.0));
-	addParam(ParamWidget::create<Trimpot>(Vec(10 + y*27, 290), module, Dice::CHANNEL_MODE_PARAM + y, 0, 5, 0));
+	addParam(ParamWidget::create<Trimpot>(Vec(10 + y*27, 290), module, Dice::CHANNEL_MODE_PARAM + y, 0, AE_HOLD, 0));
 	addInput(Port::create<PJ301MPort>(Vec(7+y*27, 310), Port::INPUT, module, Dice::CHANNEL_CLOCK_INPUT + y));
 	addOutput(Port::create<PJ301MPort>(Vec(7 + y*27, 345), Port::OUTPUT, module, Dice::GATE_OUTPUT + y));
     }
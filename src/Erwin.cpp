@@ -55,6 +55,19 @@ struct Erwin : Module {
 
     SchmittTrigger noteTriggers[12];
     SchmittTrigger monitorTrigger;
+
+    /* scales from the GUI thread (fromJson, scale import, initialize) are
+       queued and applied at the start of step() */
+    struct ScaleCommand {
+	//the first numNotes notes are replaced (old saves only have one scale)
+	bool notes[12 * NUM_SCALES];
+	int numNotes;
+	//-1 keeps the mode
+	int mode;
+    };
+    SpscQueue<ScaleCommand, 4> scaleCommands;
+    void sendScales(const ScaleCommand &c);
+    void applyScales(const ScaleCommand &c);
 };
 
 json_t* Erwin::toJson() {
@@ -82,21 +95,45 @@ void Erwin::fromJson(json_t *rootJ) {
 	return;
     }
 
-    for (unsigned int i = 0; i < json_array_size(gatesJ); i++) {
+    ScaleCommand c;
+    c.numNotes = std::min((int)json_array_size(gatesJ), 12 * NUM_SCALES);
+    for (int i = 0; i < c.numNotes; i++) {
 	json_t *gateJ = json_array_get(gatesJ, i);
-	noteState[i] = gateJ ? json_boolean_value(gateJ) : false;
+	c.notes[i] = gateJ ? json_boolean_value(gateJ) : false;
     }
     json_t *modeJ = json_object_get(rootJ, "mode");
-    if(modeJ) {
-	mode = json_integer_value(modeJ);
-    }
+    c.mode = modeJ ? json_integer_value(modeJ) : -1;
+    sendScales(c);
 }
 
 void Erwin::reset() {
-    for (int i = 0; i < 12 * NUM_SCALES; i++) noteState[i] = 0;
+    ScaleCommand c;
+    c.numNotes = 12 * NUM_SCALES;
+    for (int i = 0; i < 12 * NUM_SCALES; i++) c.notes[i] = false;
+    c.mode = -1;
+    sendScales(c);
+}
+
+/* queue new scales for step(). The scales belong to the engine thread, so
+   they are dropped if the queue is full */
+void Erwin::sendScales(const ScaleCommand &c) {
+    if(!scaleCommands.push(c))
+	debug("Erwin: command queue full, scales dropped");
+}
+
+void Erwin::applyScales(const ScaleCommand &c) {
+    for (int i = 0; i < c.numNotes; i++) {
+	noteState[i] = c.notes[i];
+    }
+    if(c.mode >= 0)
+	mode = c.mode;
 }
 
 void Erwin::step() {
+    ScaleCommand command;
+    while(scaleCommands.pop(command)) {
+	applyScales(command);
+    }
 
     //Scale selection
     int scaleOffset = clamp((int)(params[SELECT_PARAM].value + inputs[SELECT_INPUT].value * NUM_SCALES /10),0,15) * 12;
@@ -1,9 +1,28 @@
 #include "aepelzen.hpp"
 #include "dsp/digital.hpp"
+#include "AeStepper.hpp"
 
+//step buttons per channel
 const int NUM_STEPS = 16;
 const int NUM_CHANNELS = 8;
 const int NUM_GATES = NUM_STEPS * NUM_CHANNELS;
+//steps per channel, edited in pages of NUM_STEPS
+const int MAX_STEPS = 64;
+const int NUM_PAGES = MAX_STEPS / NUM_STEPS;
+//buttons, knobs and lights are processed once per block
+#define CONTROL_BLOCK 32
+//song mode
+#define MAX_SONG_ENTRIES 32
+#define MAX_SONG_REPEATS 8
+#define MAX_PLAYLIST (MAX_SONG_ENTRIES * MAX_SONG_REPEATS)
+
+//one bit per step (bit 0 is the first step)
+typedef uint64_t GateMask;
+
+inline bool gateBit(GateMask mask, int step) {
+    //step is -1 after a pattern switch with reset
+    return step >= 0 && ((mask >> step) & 1);
+}
 
 struct GateSeq : Module {
 
@@ -49,14 +68,38 @@ struct GateSeq : Module {
 	NUM_LIGHTS = GATE_LIGHTS + NUM_GATES + NUM_GATES
     };
 
-    GateSeq() : Module(NUM_PARAMS, NUM_INPUTS, NUM_OUTPUTS, NUM_LIGHTS) {}
+    GateSeq() : Module(NUM_PARAMS, NUM_INPUTS, NUM_OUTPUTS, NUM_LIGHTS) {
+	play.currentPattern = &patterns[0];
+    }
+
+    ~GateSeq() {
+	if(pendingLoadJ)
+	    json_decref(pendingLoadJ);
+    }
+
+    //the module is allocated with new, which only guarantees 16 byte alignment before C++17
+    static void *operator new(size_t size) {
+	return alignedMalloc(size, 64);
+    }
+    static void operator delete(void *p) {
+	alignedFree(p);
+    }
+
     void step() override;
     json_t *toJson() override;
     void fromJson(json_t *rootJ) override;
     void initializePattern(int bank, int pattern);
     void copyPattern(int sourcePattern, int bank, int pattern);
+    void processControls();
     void processPatternSelection();
-    bool mergePatterns(bool gate, int channel, int index, bool step);
+    void processPatternInput();
+    GateMask mergePatterns(GateMask gates, GateMask mergeGates, bool useBase);
+    void updateActiveGates(int channel);
+    void compileSong();
+    void restartSong();
+    void advanceSong();
+    void appendToSong(int p);
+    void removeFromSong(int entry);
 
     enum MergeModes {
 	MERGE_OR,
@@ -68,13 +111,51 @@ struct GateSeq : Module {
     int mergeMode = 0;
 
     struct patternInfo {
-	bool gates[NUM_GATES] = {false};
+	GateMask gates[NUM_CHANNELS] = {};
 	int length[NUM_CHANNELS] = { 16, 16, 16, 16, 16, 16, 16, 16};
 	//float prob[NUM_CHANNELS] = { 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0};
     };
 
+    std::string encodePattern(const patternInfo &p);
+    bool decodePattern(const char *hex, patternInfo &p);
+    void legacyPatternFromJson(json_t *rootJ, int index, patternInfo &p);
+
+    /* Everything step() touches on every sample, packed into a few cache lines.
+       The patterns, the buttons and the lights below are only used on steps,
+       edits and in processControls. */
+    struct alignas(64) PlaybackState {
+	patternInfo* currentPattern;
+	int controlFrame = 0;
+	bool running = true;
+	bool gatesChanged = true;
+	float phase = 0.0;
+	float prob = 0;
+	float sampleTime = 1.0 / 44100.0;
+	//internal clock frequency and channel probabilities, updated once per CONTROL_BLOCK and on steps
+	float clockFreq = 4.0;
+	float channelProb[NUM_CHANNELS] = {};
+	AeStepper<AE_FORWARD_ONLY> stepper[NUM_CHANNELS];
+	//gates of the current pattern merged with the merge pattern, updated once per step
+	//and after every change of the patterns or the merge settings
+	GateMask activeGates[NUM_CHANNELS] = {};
+
+	bool songMode = false;
+	//position in the playlist and steps of the global clock played in the current pattern
+	int songPos = -1;
+	int songStep = 0;
+	//steps of the longest channel of the current pattern
+	int patternSteps = MAX_STEPS;
+
+	SchmittTrigger clockTrigger; // for external clock
+	SchmittTrigger channelClockTrigger[NUM_CHANNELS]; // for external clock
+	SchmittTrigger resetTrigger;
+	PulseGenerator gatePulse[NUM_CHANNELS];
+	PulseGenerator clockOutPulse;
+    };
+    PlaybackState play;
+
+    //cold state
     patternInfo patterns [64] = {};
-    patternInfo* currentPattern;
 
     int bank = 0;
     int pattern = 0;
@@ -83,10 +164,7 @@ struct GateSeq : Module {
     //source pattern for merging
     int mergePattern = 0;
 
-    SchmittTrigger clockTrigger; // for external clock
-    SchmittTrigger channelClockTrigger[NUM_CHANNELS]; // for external clock
     SchmittTrigger runningTrigger;
-    SchmittTrigger resetTrigger;
     SchmittTrigger initTrigger;
     SchmittTrigger copyTrigger;
     SchmittTrigger mergeTrigger;
@@ -95,121 +173,182 @@ struct GateSeq : Module {
     SchmittTrigger bankTriggers[8];
     SchmittTrigger patternTriggers[8];
 
-    PulseGenerator gatePulse[NUM_CHANNELS];
-    PulseGenerator clockOutPulse;
-
-    float stepLights[NUM_GATES] = {};
-    int channel_index[NUM_CHANNELS] = {};
-    bool running = true;
+    float stepLights[NUM_CHANNELS * MAX_STEPS] = {};
+    //page of the step buttons
+    int page = 0;
     bool copyMode = false;
     bool mergeParam = false;
     bool lengthMode = false;
-    float phase = 0.0;
-    float prob = 0;
-    float rand = 0;
+
+    //song: patterns (0..63) with repeat counts, flattened into one playlist entry per pattern cycle
+    struct SongEntry {
+	int pattern;
+	int repeats;
+    };
+    SongEntry song[MAX_SONG_ENTRIES];
+    int songLength = 0;
+    int playlist[MAX_PLAYLIST];
+    int playlistLength = 0;
+
+    /* The song as shown by the context menu. step() publishes a copy after
+       every change, the GUI thread only reads its own copy (songView) */
+    struct SongSnapshot {
+	SongEntry song[MAX_SONG_ENTRIES];
+	int songLength = 0;
+	bool songMode = false;
+    };
+    SpscQueue<SongSnapshot, 4> songSnapshots;
+    bool songChanged = true;
+    SongSnapshot songView;
+    void publishSong();
+    void updateSongView();
+
+    /* Edits from the GUI thread (context menu, initialize, randomize and
+       fromJson) are queued and applied at the start of step(). A load is
+       pushed as one batch, so playback never sees half of it. The queue is
+       only full if step() doesn't run, then fromJson applies the load itself
+       and step() discards the older commands still in the queue */
+    struct Command {
+	enum Type {
+	    RESET,
+	    RANDOMIZE,
+	    SET_PATTERN,
+	    SELECT_PATTERN,
+	    SONG_MODE,
+	    SONG_APPEND,
+	    SONG_ADD_ENTRY,
+	    SONG_REMOVE,
+	    SONG_CLEAR,
+	    LOAD_DONE
+	};
+	Type type;
+	int pattern;
+	int value;
+	patternInfo data;
+	int generation;
+    };
+    //commands of one load: all patterns, the selection, the song, song mode and LOAD_DONE
+    static const int LOAD_COMMANDS = 64 + 1 + 1 + MAX_SONG_ENTRIES + 1 + 1;
+    //room for two loads before step() catches up
+    SpscQueue<Command, 256> commands;
+    static_assert(2 * LOAD_COMMANDS <= 256, "the command queue must hold two loads");
+    //commands of older generations are discarded by step()
+    std::atomic<int> generation {0};
+    //number of loads pushed by fromJson and the last one step() has applied
+    int loadsSent = 0;
+    std::atomic<int> loadApplied {0};
+    //copy of the last loaded patch, toJson returns it until step() has applied the load
+    json_t *pendingLoadJ = NULL;
+    Command makeCommand(Command::Type type, int pattern = 0, int value = 0, const patternInfo *data = NULL);
+    void sendCommand(Command::Type type, int pattern = 0, int value = 0, const patternInfo *data = NULL);
+    void applyCommand(const Command &c);
+
+    float getChannelProb(int channel) {
+	return clamp(inputs[CHANNEL_PROB_INPUT + channel].value /5.0 + params[CHANNEL_PROB_PARAM + channel].value, 0.0f, 1.0f);
+    }
 
     void reset() override {
-	for(int y=0;y<64;y++) {
-	    for (int i = 0; i < NUM_GATES; i++) {
-		patterns[y].gates[i] = false;
-	    }
-	    for (int i=0; i<NUM_CHANNELS; i++) {
-		patterns[y].length[i] = 16;
-	    }
-	}
-	bank = 0;
-	pattern = 0;
+	sendCommand(Command::RESET);
     }
 
     void randomize() override {
-	for (int i=0; i<NUM_CHANNELS; i++) {
-	    for (int y=0; y<NUM_STEPS; y++) {
-		currentPattern->gates[i*NUM_CHANNELS + y] = (randomUniform() > 0.5);
-	    }
-	    currentPattern->length[i] = (int)(randomUniform()*15) + 1;
-	}
+	sendCommand(Command::RANDOMIZE);
     }
 };
 
 
 void GateSeq::step() {
-    float gSampleRate = engineGetSampleRate();
-    //const float lightLambda = 0.075;
-    const float lightLambda = 0.05;
+    Command command;
+    int g = generation.load();
+    while(commands.pop(command)) {
+	if(command.generation == g)
+	    applyCommand(command);
+    }
+    if(songChanged)
+	publishSong();
 
-    // Run
-    if (runningTrigger.process(params[RUN_PARAM].value))
-	running = !running;
-    lights[RUNNING_LIGHT].value = running ? 1.0 : 0.0;
+    if(play.controlFrame == 0)
+	processControls();
+    if(++play.controlFrame >= CONTROL_BLOCK)
+	play.controlFrame = 0;
 
-    processPatternSelection();
     bool nextStep = false;
 
-    if(lengthTrigger.process(params[LENGTH_PARAM].value)) {
-	lengthMode = !lengthMode;
-    }
-    lights[LENGTH_LIGHT].value = (lengthMode) ? 1.0 : 0.0;
-
-    if (running) {
+    if (play.running) {
 	if (inputs[EXT_CLOCK_INPUT].active) {
 	    // External clock
-	    if (clockTrigger.process(inputs[EXT_CLOCK_INPUT].value)) {
+	    if (play.clockTrigger.process(inputs[EXT_CLOCK_INPUT].value)) {
 		nextStep = true;
 	    }
 	}
 	else {
 	    // Internal clock
-	    float clockTime = powf(2.0, params[CLOCK_PARAM].value + inputs[CLOCK_INPUT].value);
-	    phase += clockTime / gSampleRate;
-	    if (phase >= 1.0) {
-		phase -= 1.0;
+	    play.phase += play.clockFreq * play.sampleTime;
+	    if (play.phase >= 1.0) {
+		play.phase -= 1.0;
 		nextStep = true;
 	    }
 	}
 
 	if(nextStep)
-	    clockOutPulse.trigger(1e-3);
-
-	bool pulse = false;
-	bool channelStep = false;
+	    play.clockOutPulse.trigger(1e-3);
 
+	//channel clock overwrite
+	bool channelStep[NUM_CHANNELS];
+	bool anyStep = false;
 	for (int y = 0; y < NUM_CHANNELS; y++) {
-	    float channelProb = clamp(inputs[CHANNEL_PROB_INPUT + y].value /5.0 + params[CHANNEL_PROB_PARAM + y].value, 0.0f, 1.0f);
-	    //channel clock overwrite
-	    channelStep = false;
-	    if(inputs[CHANNEL_CLOCK_INPUT + y].active) {
-		if (channelClockTrigger[y].process(inputs[CHANNEL_CLOCK_INPUT + y].value)) {
-		    channelStep = true;
-		}
+	    if(inputs[CHANNEL_CLOCK_INPUT + y].active)
+		channelStep[y] = play.channelClockTrigger[y].process(inputs[CHANNEL_CLOCK_INPUT + y].value);
+	    else
+		channelStep[y] = nextStep;
+	    anyStep = anyStep || channelStep[y];
+	}
+
+	//switch patterns in time with the clock
+	if(play.songMode) {
+	    if(nextStep && playlistLength > 0) {
+		if(play.songStep >= play.patternSteps)
+		    advanceSong();
+		play.songStep++;
 	    }
-	    else {
-		channelStep = nextStep;
+	}
+	else if(anyStep && inputs[PATTERN_INPUT].active)
+	    processPatternInput();
+
+	if(play.gatesChanged) {
+	    play.patternSteps = 1;
+	    for(int y=0;y<NUM_CHANNELS;y++) {
+		updateActiveGates(y);
+		play.patternSteps = std::max(play.patternSteps, play.currentPattern->length[y] ? play.currentPattern->length[y] : 16);
 	    }
+	    play.gatesChanged = false;
+	}
+
+	for (int y = 0; y < NUM_CHANNELS; y++) {
 	    // Advance step
-	    if (channelStep) {
+	    if (channelStep[y]) {
 		//int numSteps = clampi(roundf(params[CHANNEL_STEPS_PARAM+y].value), 1, NUM_STEPS);
-		int numSteps = currentPattern->length[y];
+		int numSteps = play.currentPattern->length[y];
 		//workaround to fix crashes on old saves without pattern support
 		if(numSteps == 0)
 		    numSteps = 16;
-		channel_index[y] = (channel_index[y] + 1) % numSteps;
-		stepLights[y*NUM_STEPS + channel_index[y]] = 1.0;
-		gatePulse[y].trigger(1e-3);
+		play.stepper[y].advance(AE_FORWARD, numSteps);
+		stepLights[y*MAX_STEPS + play.stepper[y].index] = 1.0;
+		play.gatePulse[y].trigger(1e-3);
+		play.channelProb[y] = getChannelProb(y);
 		//only compute new random number for active steps
-		if (currentPattern->gates[y*NUM_STEPS + channel_index[y]] && channelProb < 1) {
-		    prob = randomUniform();
+		if (gateBit(play.currentPattern->gates[y], play.stepper[y].index) && play.channelProb[y] < 1) {
+		    play.prob = randomUniform();
 		}
+		//new random choice for MERGE_RAND
+		updateActiveGates(y);
 	    }
 
-	    pulse = gatePulse[y].process(1.0 / engineGetSampleRate());
-	    bool gateOn = currentPattern->gates[y*NUM_STEPS + channel_index[y]];
+	    bool pulse = play.gatePulse[y].process(play.sampleTime);
+	    bool gateOn = gateBit(play.activeGates[y], play.stepper[y].index);
 
-	    if(mergeParam) {
-		//gateOn = gateOn || patterns[mergePattern].gates[y*NUM_STEPS + channel_index[y]];
-		gateOn =  mergePatterns(gateOn, y, channel_index[y], channelStep);
-	    }
 	    //probability
-	    if(prob > channelProb) {
+	    if(play.prob > play.channelProb[y]) {
 		gateOn = false;
 	    }
 	    gateOn = gateOn && !pulse;
@@ -224,38 +363,85 @@ void GateSeq::step() {
     }
 
     // Reset
-    if (resetTrigger.process(params[RESET_PARAM].value + inputs[RESET_INPUT].value)) {
-	phase = 0.0;
+    if (play.resetTrigger.process(params[RESET_PARAM].value + inputs[RESET_INPUT].value)) {
+	play.phase = 0.0;
 	for (int y = 0; y < NUM_CHANNELS; y++) {
-	    channel_index[y] = 0;
+	    play.stepper[y].index = 0;
 	}
+	if(play.songMode)
+	    restartSong();
 	nextStep = true;
 	lights[RESET_LIGHT].value = 1.0;
     }
-    lights[RESET_LIGHT].value -= lights[RESET_LIGHT].value / lightLambda / gSampleRate;
 
-    // Gate buttons
+    //clock out
+    outputs[CLOCK_OUTPUT].value = play.clockOutPulse.process(play.sampleTime) ? 10.0 : 0.0;
+}
+
+/* buttons, knobs and lights (once per CONTROL_BLOCK) */
+void GateSeq::processControls() {
+    float gSampleRate = engineGetSampleRate();
+    play.sampleTime = 1.0 / gSampleRate;
+    //const float lightLambda = 0.075;
+    const float lightLambda = 0.05;
+    //decay of the step and reset lights over one block
+    float lightDecay = expf(-CONTROL_BLOCK / lightLambda / gSampleRate);
+
+    // Run
+    if (runningTrigger.process(params[RUN_PARAM].value))
+	play.running = !play.running;
+    lights[RUNNING_LIGHT].value = play.running ? 1.0 : 0.0;
+
+    processPatternSelection();
+
+    if(lengthTrigger.process(params[LENGTH_PARAM].value)) {
+	lengthMode = !lengthMode;
+    }
+    lights[LENGTH_LIGHT].value = (lengthMode) ? 1.0 : 0.0;
+
+    play.clockFreq = powf(2.0, params[CLOCK_PARAM].value + inputs[CLOCK_INPUT].value);
+    for (int y = 0; y < NUM_CHANNELS; y++) {
+	play.channelProb[y] = getChannelProb(y);
+    }
+
+    lights[RESET_LIGHT].value *= lightDecay;
+
+    for (int i = 0; i < NUM_CHANNELS * MAX_STEPS; i++) {
+	stepLights[i] *= lightDecay;
+    }
+
+    // Gate buttons (on the current page)
     for (int i = 0; i < NUM_GATES; i++) {
+	int channel = i / NUM_STEPS;
+	int step = page * NUM_STEPS + i % NUM_STEPS;
 	if (gateTriggers[i].process(params[GATE1_PARAM + i].value)) {
 	    if(lengthMode) {
-		currentPattern->length[i/NUM_STEPS] = (i % NUM_STEPS ) + 1;
+		play.currentPattern->length[channel] = step + 1;
+		play.gatesChanged = true;
+	    }
+	    else {
+		play.currentPattern->gates[channel] ^= (GateMask)1 << step;
+		play.gatesChanged = true;
 	    }
-	    else
-		currentPattern->gates[i] = !currentPattern->gates[i];
 	}
-	stepLights[i] -= stepLights[i] / lightLambda / gSampleRate;
-	lights[GATE_LIGHTS + 2*i].value = (currentPattern->gates[i] >= 1.0) ? 0.7 - stepLights[i] : stepLights[i];
-	lights[GATE_LIGHTS + 2*i + 1].value = ( lengthMode && (i % NUM_STEPS + 1) == currentPattern->length[i/NUM_STEPS]) ? 1.0 : 0.0;
+	float stepLight = stepLights[channel*MAX_STEPS + step];
+	lights[GATE_LIGHTS + 2*i].value = gateBit(play.currentPattern->gates[channel], step) ? 0.7 - stepLight : stepLight;
+	lights[GATE_LIGHTS + 2*i + 1].value = ( lengthMode && step + 1 == play.currentPattern->length[channel]) ? 1.0 : 0.0;
     }
-
-    //clock out
-    outputs[CLOCK_OUTPUT].value = clockOutPulse.process(1.0/engineGetSampleRate()) ? 10.0 : 0.0;
 }
 
 struct GateSeqWidget : ModuleWidget {
 	GateSeqWidget(GateSeq *module);
+	void step() override;
+	Menu *createContextMenu() override;
 };
 
+void GateSeqWidget::step() {
+    //keep the song of the context menu up to date while it is open
+    static_cast<GateSeq*>(module)->updateSongView();
+    ModuleWidget::step();
+}
+
 GateSeqWidget::GateSeqWidget(GateSeq *module) : ModuleWidget(module) {
     box.size = Vec(525, 380);
 
@@ -317,6 +503,10 @@ GateSeqWidget::GateSeqWidget(GateSeq *module) : ModuleWidget(module) {
 }
 
 void GateSeq::processPatternSelection() {
+    int lastPattern = 8*bank + pattern;
+    int lastMergePattern = mergePattern;
+    bool lastMergeParam = mergeParam;
+
     if(initTrigger.process(params[INIT_PARAM].value))
 	initializePattern(bank, pattern);
 
@@ -347,89 +537,245 @@ void GateSeq::processPatternSelection() {
 	lights[BANK_LIGHTS + i].value = (bank == i) ? 1.0 : 0.0;
     }
     //pattern
-    for(int i=0;i<8;i++) {
-	if(inputs[PATTERN_INPUT].active) {
-	    int in = clamp((int)trunc(inputs[PATTERN_INPUT].value),0 , 7);
-	    if (in != pattern && params[PATTERN_SWITCH_MODE_PARAM].value) {
-		for(int y=0;y<NUM_CHANNELS;y++) {
-		    channel_index[y] = -1;
+    if(inputs[PATTERN_INPUT].active && !play.songMode) {
+	processPatternInput();
+    }
+    else {
+	for(int i=0;i<8;i++) {
+	    if(patternTriggers[i].process(params[PATTERN_PARAM + i].value)) {
+		if(mergeParam) {
+		    mergePattern = 8*bank + i;
 		}
-	    }
-	    pattern = in;
-	}
-	else if(patternTriggers[i].process(params[PATTERN_PARAM + i].value)) {
-	    if(mergeParam) {
-		mergePattern = 8*bank + i;
-	    }
-	    else {
-		pattern = i;
-		//reset index
-		if(params[PATTERN_SWITCH_MODE_PARAM].value) {
-		    for(int y=0;y<NUM_CHANNELS;y++) {
-			channel_index[y] = -1;
+		else {
+		    pattern = i;
+		    //reset index
+		    if(params[PATTERN_SWITCH_MODE_PARAM].value) {
+			for(int y=0;y<NUM_CHANNELS;y++) {
+			    play.stepper[y].index = -1;
+			}
 		    }
 		}
+		break;
 	    }
-	    break;
 	}
     }
     for(int i=0;i<8;i++) {
 	lights[PATTERN_LIGHTS + i].value = (pattern == i || (mergeParam && mergePattern == i)) ? 1.0 : 0.0;
     }
-    currentPattern = &patterns[8*bank + pattern];
+    play.currentPattern = &patterns[8*bank + pattern];
+
+    int mode = params[MERGE_MODE_PARAM].value;
+    if(8*bank + pattern != lastPattern || mergePattern != lastMergePattern || mergeParam != lastMergeParam || mode != mergeMode) {
+	mergeMode = mode;
+	play.gatesChanged = true;
+    }
 }
 
-/**
-   Merge Pattern steps
+/* pattern from the pattern input, this is also read on every step */
+void GateSeq::processPatternInput() {
+    int in = clamp((int)trunc(inputs[PATTERN_INPUT].value),0 , 7);
+    if (in == pattern)
+	return;
+    if (params[PATTERN_SWITCH_MODE_PARAM].value) {
+	for(int y=0;y<NUM_CHANNELS;y++) {
+	    play.stepper[y].index = -1;
+	}
+    }
+    pattern = in;
+    play.currentPattern = &patterns[8*bank + pattern];
+    play.gatesChanged = true;
+}
 
-   @param gate Gate State of the base Pattern
-   @param channel
-   @param index Position in channel
-   @param step true if the index increased in the active cycle (i.e. we have a new step)
-*/
-bool GateSeq::mergePatterns(bool gate, int channel, int index, bool step) {
-    bool out = false;
-    mergeMode = params[MERGE_MODE_PARAM].value;
-    if(step)
-	rand = randomUniform();
+GateSeq::Command GateSeq::makeCommand(Command::Type type, int pattern, int value, const patternInfo *data) {
+    Command c;
+    c.type = type;
+    c.pattern = pattern;
+    c.value = value;
+    if(data)
+	c.data = *data;
+    c.generation = generation.load();
+    return c;
+}
 
-    switch (mergeMode) {
-    case MERGE_OR: {
-	out = gate || patterns[mergePattern].gates[channel*NUM_STEPS + index];
+/* queue an edit for step(). The state belongs to the engine thread, so the
+   edit is dropped if the queue is full */
+void GateSeq::sendCommand(Command::Type type, int pattern, int value, const patternInfo *data) {
+    if(!commands.push(makeCommand(type, pattern, value, data)))
+	debug("GateSeq: command queue full, edit dropped");
+}
+
+void GateSeq::applyCommand(const Command &c) {
+    switch(c.type) {
+    case Command::RESET: {
+	for(int y=0;y<64;y++) {
+	    patterns[y] = patternInfo();
+	}
+	bank = 0;
+	pattern = 0;
+	play.currentPattern = &patterns[0];
+	play.gatesChanged = true;
+	songLength = 0;
+	play.songMode = false;
+	compileSong();
 	break;
     }
-    case MERGE_AND: {
-	out = gate && patterns[mergePattern].gates[channel*NUM_STEPS + index];
+    case Command::RANDOMIZE: {
+	for (int i=0; i<NUM_CHANNELS; i++) {
+	    GateMask gates = 0;
+	    for (int y=0; y<MAX_STEPS; y++) {
+		if(randomUniform() > 0.5)
+		    gates |= (GateMask)1 << y;
+	    }
+	    play.currentPattern->gates[i] = gates;
+	    play.currentPattern->length[i] = (int)(randomUniform()*15) + 1;
+	}
+	play.gatesChanged = true;
 	break;
     }
-    case MERGE_XOR: {
-	out = gate ^ patterns[mergePattern].gates[channel*NUM_STEPS + index];
+    case Command::SET_PATTERN:
+	patterns[c.pattern] = c.data;
+	play.gatesChanged = true;
 	break;
-    }
-    case MERGE_NOR: {
-	out = !(gate || patterns[mergePattern].gates[channel*NUM_STEPS + index]);
+    case Command::SELECT_PATTERN:
+	bank = c.pattern / 8;
+	pattern = c.pattern % 8;
+	play.currentPattern = &patterns[c.pattern];
+	play.gatesChanged = true;
 	break;
-    }
-    case MERGE_RAND: {
-	if(rand > 0.5)
-	    out = gate;
-	else
-	    out = patterns[mergePattern].gates[channel*NUM_STEPS + index];
+    case Command::SONG_MODE:
+	play.songMode = c.value;
+	if(play.songMode)
+	    restartSong();
+	songChanged = true;
+	break;
+    case Command::SONG_APPEND:
+	appendToSong(c.pattern);
+	break;
+    case Command::SONG_ADD_ENTRY:
+	if(songLength < MAX_SONG_ENTRIES) {
+	    song[songLength++] = {c.pattern, c.value};
+	    compileSong();
+	}
+	break;
+    case Command::SONG_REMOVE:
+	if(c.value < songLength)
+	    removeFromSong(c.value);
+	break;
+    case Command::SONG_CLEAR:
+	songLength = 0;
+	compileSong();
+	break;
+    case Command::LOAD_DONE:
+	loadApplied = c.value;
 	break;
     }
+}
+
+/* copy the song for the context menu. If the queue is full the GUI thread
+   hasn't caught up yet, step() tries again */
+void GateSeq::publishSong() {
+    SongSnapshot snapshot;
+    for(int i=0;i<songLength;i++) {
+	snapshot.song[i] = song[i];
     }
-    return out;
+    snapshot.songLength = songLength;
+    snapshot.songMode = play.songMode;
+    if(songSnapshots.push(snapshot))
+	songChanged = false;
 }
 
-void GateSeq::initializePattern(int bank, int pattern) {
-    for(int i=0;i<NUM_GATES;i++) {
-	currentPattern->gates[i] = 0;
+//GUI thread: take the latest song published by step()
+void GateSeq::updateSongView() {
+    while(songSnapshots.pop(songView)) {}
+}
+
+/* flatten the song into one playlist entry per pattern cycle */
+void GateSeq::compileSong() {
+    int n = 0;
+    for(int i=0;i<songLength;i++) {
+	for(int k=0;k<song[i].repeats;k++) {
+	    playlist[n++] = song[i].pattern;
+	}
     }
+    playlistLength = n;
+    if(play.songPos >= n)
+	play.songPos = -1;
+    songChanged = true;
+}
 
-    for (int i = 0; i<NUM_CHANNELS; i++) {
-	currentPattern->length[i] = 16;
-	//currentPatternp->rob[i] = 1;
+/* start with the first playlist entry on the next clock */
+void GateSeq::restartSong() {
+    play.songPos = -1;
+    play.songStep = MAX_STEPS;
+}
+
+/* next pattern of the playlist, it always starts from the first step */
+void GateSeq::advanceSong() {
+    if(++play.songPos >= playlistLength)
+	play.songPos = 0;
+    int p = playlist[play.songPos];
+    bank = p / 8;
+    pattern = p % 8;
+    play.currentPattern = &patterns[p];
+    for(int y=0;y<NUM_CHANNELS;y++) {
+	play.stepper[y].index = -1;
     }
+    play.gatesChanged = true;
+    play.songStep = 0;
+}
+
+/* append a pattern to the song, or repeat the last entry if it is the same pattern */
+void GateSeq::appendToSong(int p) {
+    if(songLength > 0 && song[songLength - 1].pattern == p && song[songLength - 1].repeats < MAX_SONG_REPEATS)
+	song[songLength - 1].repeats++;
+    else if(songLength < MAX_SONG_ENTRIES)
+	song[songLength++] = {p, 1};
+    compileSong();
+}
+
+void GateSeq::removeFromSong(int entry) {
+    for(int i=entry;i<songLength-1;i++) {
+	song[i] = song[i+1];
+    }
+    songLength--;
+    compileSong();
+}
+
+/**
+   Merge the steps of two patterns
+
+   @param gates Steps of the base Pattern
+   @param mergeGates Steps of the merge Pattern
+   @param useBase MERGE_RAND only: take the base pattern
+*/
+GateMask GateSeq::mergePatterns(GateMask gates, GateMask mergeGates, bool useBase) {
+    switch (mergeMode) {
+    case MERGE_OR:
+	return gates | mergeGates;
+    case MERGE_AND:
+	return gates & mergeGates;
+    case MERGE_XOR:
+	return gates ^ mergeGates;
+    case MERGE_NOR:
+	return ~(gates | mergeGates);
+    case MERGE_RAND:
+	return useBase ? gates : mergeGates;
+    }
+    return gates;
+}
+
+/* compute the gates of one channel (this draws a new random choice for MERGE_RAND) */
+void GateSeq::updateActiveGates(int channel) {
+    GateMask gates = play.currentPattern->gates[channel];
+    if(mergeParam) {
+	gates = mergePatterns(gates, patterns[mergePattern].gates[channel], randomUniform() > 0.5);
+    }
+    play.activeGates[channel] = gates;
+}
+
+void GateSeq::initializePattern(int bank, int pattern) {
+    patterns[8*bank + pattern] = patternInfo();
+    play.gatesChanged = true;
 }
 
 /**
@@ -442,40 +788,93 @@ void GateSeq::initializePattern(int bank, int pattern) {
 void GateSeq::copyPattern(int sourcePattern, int bank, int pattern) {
     //currentPattern = &patterns[8*bank + pattern];
     printf("Copying pattern: %d to bank: %d, pattern:%d\n", sourcePattern, bank, pattern);
-    for (int i=0; i<NUM_GATES; i++) {
-	patterns[8*bank + pattern].gates[i] = patterns[sourcePattern].gates[i];
+    patterns[8*bank + pattern] = patterns[sourcePattern];
+    play.gatesChanged = true;
+}
+
+/* Patterns are saved as one hex string each. For every channel it holds the
+   length (2 digits) followed by the step mask (MAX_STEPS / 4 digits, first step in the lowest bit).
+   Older versions with 16 steps wrote 4 digits per mask */
+static void appendHex(std::string &s, uint64_t value, int digits) {
+    static const char hexDigits[] = "0123456789abcdef";
+    for(int i=digits-1;i>=0;i--) {
+	s += hexDigits[(value >> (4*i)) & 0xf];
+    }
+}
+
+static int hexValue(char c) {
+    if(c >= '0' && c <= '9')
+	return c - '0';
+    if(c >= 'a' && c <= 'f')
+	return c - 'a' + 10;
+    if(c >= 'A' && c <= 'F')
+	return c - 'A' + 10;
+    return -1;
+}
+
+static bool parseHex(const char *s, int digits, uint64_t &value) {
+    value = 0;
+    for(int i=0;i<digits;i++) {
+	int v = hexValue(s[i]);
+	if(v < 0)
+	    return false;
+	value = (value << 4) | v;
+    }
+    return true;
+}
+
+std::string GateSeq::encodePattern(const patternInfo &p) {
+    std::string s;
+    for(int i=0;i<NUM_CHANNELS;i++) {
+	appendHex(s, p.length[i], 2);
+	appendHex(s, p.gates[i], MAX_STEPS / 4);
     }
+    return s;
+}
+
+bool GateSeq::decodePattern(const char *hex, patternInfo &p) {
+    if(!hex || strlen(hex) % NUM_CHANNELS != 0)
+	return false;
+    int digits = strlen(hex) / NUM_CHANNELS;
+    if(digits < 3 || digits > 2 + MAX_STEPS / 4)
+	return false;
+    patternInfo decoded;
     for(int i=0;i<NUM_CHANNELS;i++) {
-	patterns[8*bank + pattern].length[i] = patterns[sourcePattern].length[i];
+	uint64_t length, gates;
+	if(!parseHex(hex + i*digits, 2, length) || !parseHex(hex + i*digits + 2, digits - 2, gates))
+	    return false;
+	//0 comes from old saves without lengths, it plays 16 steps
+	decoded.length[i] = (length == 0) ? NUM_STEPS : clamp((int)length, 1, MAX_STEPS);
+	decoded.gates[i] = gates;
     }
+    p = decoded;
+    return true;
 }
 
 json_t* GateSeq::toJson() {
+    //a load step() hasn't applied yet
+    if(pendingLoadJ && loadApplied != loadsSent)
+	return json_deep_copy(pendingLoadJ);
+
     json_t *rootJ = json_object();
 
     //patterns
     json_t *patternsJ = json_array();
-    json_t *lengthsJ = json_array();
-
     for(int y=0;y<64;y++) {
-	// Gate values
-	json_t *gatesJ = json_array();
-	for (int i = 0; i < NUM_GATES; i++) {
-	    json_t *gateJ = json_integer((int) patterns[y].gates[i]);
-	    json_array_append_new(gatesJ, gateJ);
-	}
-	json_array_append_new(patternsJ, gatesJ);
+	json_array_append_new(patternsJ, json_string(encodePattern(patterns[y]).c_str()));
+    }
+    json_object_set_new(rootJ, "hexPatterns", patternsJ);
 
-	//second array for lengths to keep things simple
-	json_t *pLengthJ = json_array();
-	for(int i=0;i<NUM_CHANNELS;i++) {
-	    json_t* lengthJ = json_integer(patterns[y].length[i]);
-	    json_array_append_new(pLengthJ, lengthJ);
-	}
-	json_array_append_new(lengthsJ, pLengthJ);
+    //song as [pattern, repeats] pairs
+    json_t *songJ = json_array();
+    for(int i=0;i<songLength;i++) {
+	json_t *entryJ = json_array();
+	json_array_append_new(entryJ, json_integer(song[i].pattern));
+	json_array_append_new(entryJ, json_integer(song[i].repeats));
+	json_array_append_new(songJ, entryJ);
     }
-    json_object_set_new(rootJ, "patterns", patternsJ);
-    json_object_set_new(rootJ, "lengths", lengthsJ);
+    json_object_set_new(rootJ, "song", songJ);
+    json_object_set_new(rootJ, "songMode", json_boolean(play.songMode));
 
     json_t *activePatternJ = json_integer(pattern);
     json_object_set_new(rootJ, "pattern", activePatternJ);
@@ -485,29 +884,151 @@ json_t* GateSeq::toJson() {
 }
 
 void GateSeq::fromJson(json_t *rootJ) {
-    json_t *patternsJ = json_object_get(rootJ, "patterns");
-    json_t *lengthsJ = json_object_get(rootJ, "lengths");
+    std::vector<Command> load;
+    load.reserve(LOAD_COMMANDS);
 
+    json_t *patternsJ = json_object_get(rootJ, "hexPatterns");
     for(int y=0;y<64;y++) {
-	// Gate values
-	json_t *gatesJ = json_array_get(patternsJ, y);
-	for (int i = 0; i < NUM_GATES; i++) {
-	    json_t *gateJ = json_array_get(gatesJ, i);
-	    //patterns[y][i] = json_integer_value(gateJ);
-	    patterns[y].gates[i] = json_integer_value(gateJ);
+	patternInfo p;
+	if(patternsJ) {
+	    json_t *patternJ = json_array_get(patternsJ, y);
+	    if(patternJ)
+		decodePattern(json_string_value(patternJ), p);
 	}
-	json_t *pLengthsJ = json_array_get(lengthsJ, y);
-	for(int i=0;i<NUM_CHANNELS;i++) {
-	    json_t *lengthJ = json_array_get(pLengthsJ, i);
-	    patterns[y].length[i] = json_integer_value(lengthJ);
+	else {
+	    legacyPatternFromJson(rootJ, y, p);
 	}
+	load.push_back(makeCommand(Command::SET_PATTERN, y, 0, &p));
     }
+
     json_t * patternJ = json_object_get(rootJ, "pattern");
-    pattern = json_integer_value(patternJ);
     json_t * bankJ = json_object_get(rootJ, "bank");
-    bank = json_integer_value(bankJ);
+    load.push_back(makeCommand(Command::SELECT_PATTERN, 8*clamp((int)json_integer_value(bankJ), 0, 7) + clamp((int)json_integer_value(patternJ), 0, 7)));
+
+    json_t *songJ = json_object_get(rootJ, "song");
+    load.push_back(makeCommand(Command::SONG_CLEAR));
+    for(int i=0;i<(int)json_array_size(songJ) && i<MAX_SONG_ENTRIES;i++) {
+	json_t *entryJ = json_array_get(songJ, i);
+	load.push_back(makeCommand(Command::SONG_ADD_ENTRY, clamp((int)json_integer_value(json_array_get(entryJ, 0)), 0, 63),
+				   clamp((int)json_integer_value(json_array_get(entryJ, 1)), 1, MAX_SONG_REPEATS)));
+    }
+    load.push_back(makeCommand(Command::SONG_MODE, 0, json_is_true(json_object_get(rootJ, "songMode"))));
+    load.push_back(makeCommand(Command::LOAD_DONE, 0, ++loadsSent));
+
+    if(pendingLoadJ) {
+	json_decref(pendingLoadJ);
+	pendingLoadJ = NULL;
+    }
+    if(commands.push(load.data(), load.size())) {
+	pendingLoadJ = json_deep_copy(rootJ);
+	return;
+    }
+
+    //step() isn't running, apply the load here. The queued commands are older, discard them
+    info("GateSeq: command queue full, applying the patch directly");
+    generation++;
+    for(const Command &c : load) {
+	applyCommand(c);
+    }
+}
+
+/* old format with one integer per gate and a separate array of lengths */
+void GateSeq::legacyPatternFromJson(json_t *rootJ, int index, patternInfo &p) {
+    json_t *patternsJ = json_object_get(rootJ, "patterns");
+    json_t *lengthsJ = json_object_get(rootJ, "lengths");
+
+    // Gate values (16 steps per channel)
+    json_t *gatesJ = json_array_get(patternsJ, index);
+    for (int i = 0; i < NUM_CHANNELS; i++) {
+	GateMask gates = 0;
+	for(int x=0;x<NUM_STEPS;x++) {
+	    if(json_integer_value(json_array_get(gatesJ, i*NUM_STEPS + x)))
+		gates |= (GateMask)1 << x;
+	}
+	p.gates[i] = gates;
+    }
+    json_t *pLengthsJ = json_array_get(lengthsJ, index);
+    for(int i=0;i<NUM_CHANNELS;i++) {
+	json_t *lengthJ = json_array_get(pLengthsJ, i);
+	//saves without pattern support have no lengths, these play 16 steps
+	int length = json_integer_value(lengthJ);
+	p.length[i] = (length == 0) ? NUM_STEPS : clamp(length, 1, MAX_STEPS);
+    }
+}
+
+struct GateSeqPageItem : MenuItem {
+    GateSeq *module;
+    int page;
+    void onAction(EventAction &e) override {
+	module->page = page;
+    }
+    void step() override {
+	rightText = (module->page == page) ? "✔" : "";
+	MenuItem::step();
+    }
+};
+
+struct GateSeqSongModeItem : MenuItem {
+    GateSeq *module;
+    void onAction(EventAction &e) override {
+	module->sendCommand(GateSeq::Command::SONG_MODE, 0, !module->songView.songMode);
+    }
+    void step() override {
+	rightText = (module->songView.songMode) ? "✔" : "";
+	MenuItem::step();
+    }
+};
+
+struct GateSeqSongAppendItem : MenuItem {
+    GateSeq *module;
+    void onAction(EventAction &e) override {
+	module->sendCommand(GateSeq::Command::SONG_APPEND, 8*module->bank + module->pattern);
+    }
+};
+
+struct GateSeqSongEntryItem : MenuItem {
+    GateSeq *module;
+    int entry;
+    void onAction(EventAction &e) override {
+	module->sendCommand(GateSeq::Command::SONG_REMOVE, 0, entry);
+    }
+};
+
+struct GateSeqSongClearItem : MenuItem {
+    GateSeq *module;
+    void onAction(EventAction &e) override {
+	module->sendCommand(GateSeq::Command::SONG_CLEAR);
+    }
+};
+
+Menu *GateSeqWidget::createContextMenu() {
+    Menu *menu = ModuleWidget::createContextMenu();
+
+    GateSeq *gateSeq = dynamic_cast<GateSeq*>(module);
+    assert(gateSeq);
+
+    menu->addChild(construct<MenuEntry>());
+    menu->addChild(construct<MenuLabel>(&MenuLabel::text, "Step Buttons"));
+    for(int i=0;i<NUM_PAGES;i++) {
+	std::string text = stringf("Steps %d-%d", i*NUM_STEPS + 1, (i+1)*NUM_STEPS);
+	menu->addChild(construct<GateSeqPageItem>(&GateSeqPageItem::text, text, &GateSeqPageItem::module, gateSeq, &GateSeqPageItem::page, i));
+    }
+
+    menu->addChild(construct<MenuEntry>());
+    menu->addChild(construct<MenuLabel>(&MenuLabel::text, "Song"));
+    menu->addChild(construct<GateSeqSongModeItem>(&GateSeqSongModeItem::text, "Song Mode", &GateSeqSongModeItem::module, gateSeq));
+    menu->addChild(construct<GateSeqSongAppendItem>(&GateSeqSongAppendItem::text, "Append Current Pattern", &GateSeqSongAppendItem::module, gateSeq));
+    //click on an entry to remove it
+    gateSeq->updateSongView();
+    for(int i=0;i<gateSeq->songView.songLength;i++) {
+	GateSeq::SongEntry &e = gateSeq->songView.song[i];
+	std::string text = stringf("%d: Bank %d Pattern %d x%d", i + 1, e.pattern / 8 + 1, e.pattern % 8 + 1, e.repeats);
+	menu->addChild(construct<GateSeqSongEntryItem>(&GateSeqSongEntryItem::text, text, &GateSeqSongEntryItem::rightText, "Remove", &GateSeqSongEntryItem::module, gateSeq, &GateSeqSongEntryItem::entry, i));
+    }
+    if(gateSeq->songView.songLength > 0)
+	menu->addChild(construct<GateSeqSongClearItem>(&GateSeqSongClearItem::text, "Clear Song", &GateSeqSongClearItem::module, gateSeq));
 
-    currentPattern = &patterns[8*bank + pattern];
+    return menu;
 }
 
 Model *modelGateSeq = Model::create<GateSeq, GateSeqWidget>("Aepelzens Modules", "GateSEQ", "Gate Sequencer", SEQUENCER_TAG);
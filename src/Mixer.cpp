@@ -1,35 +1,428 @@
 #include "aepelzen.hpp"
 #include "AeFilter.hpp"
+#include "AeOversampler.hpp"
 #include "dsp/vumeter.hpp"
 #include "dsp/digital.hpp"
+#include <vector>
+#include <algorithm>
+
+//channels whose input and filter state stay below this level are not processed
+#define SILENCE_THRESHOLD 1e-6f
+#define SILENCE_SAMPLES 64
+//gain, pan, aux and eq knobs are read once per block and ramped in between
+#define PARAM_BLOCK 32
+//meter lights are updated once per block
+#define METER_BLOCK 256
+//peak hold time in seconds
+#define METER_HOLD_TIME 1.0f
+//oversampling of the true peak detector
+#define TRUE_PEAK_FACTOR 4
+
+//destinations of a channel, each channel has one gain per destination
+enum MixerSends {
+    SEND_L,
+    SEND_R,
+    SEND_AUX1_L,
+    SEND_AUX1_R,
+    SEND_AUX2_L,
+    SEND_AUX2_R,
+    NUM_SENDS
+};
+
+//longest chain of expanders a Mixer runs (guards against a transient loop while modules are moved)
+#define MAX_EXPANDERS 16
+
+//EQ coefficients shared by all mixers, the tables cover the knob ranges set in the widgets
+static AeSharedEqualizerTable channelLowTable(125.0f, 0.45f, -20.0f, 20.0f, AeEQType::AeLOWSHELVE);
+static AeSharedEqualizerTable channelMidTable(1200.0f, 0.52f, -12.5f, 12.5f, AeEQType::AePEAKINGEQ);
+static AeSharedEqualizerTable channelHighTable(1800.0f, 0.4f, -15.0f, 15.0f, AeEQType::AeHIGHSHELVE);
+static AeSharedEqualizerTable masterLowTable(120.0f, 0.45f, -10.0f, 10.0f, AeEQType::AeLOWSHELVE);
+static AeSharedEqualizerTable masterMidTable(1300.0f, 0.95f, -7.0f, 7.0f, AeEQType::AePEAKINGEQ);
+static AeSharedEqualizerTable masterHighTable(1700.0f, 0.45f, -7.0f, 7.0f, AeEQType::AeHIGHSHELVE);
+
+/* Common base of Mixer and MixerExpander. A Mixer runs the channel strips of
+   the chain of expanders to its right in its own step */
+struct MixerModule : Module {
+    //expander directly to the right, written by the expander widgets
+    std::atomic<MixerModule*> right {nullptr};
+    //set by the Mixer when it ran this module's channels, only used on the engine thread
+    bool pulled = false;
+
+    //all instances, created and deleted on the GUI thread
+    static std::vector<MixerModule*> &instances() {
+	static std::vector<MixerModule*> modules;
+	return modules;
+    }
+
+    MixerModule(int numParams, int numInputs, int numOutputs, int numLights) : Module(numParams, numInputs, numOutputs, numLights) {
+	instances().push_back(this);
+    }
+
+    ~MixerModule() {
+	std::vector<MixerModule*> &modules = instances();
+	modules.erase(std::remove(modules.begin(), modules.end(), this), modules.end());
+    }
+
+    /* Drops all links to expander except the one from left (may be NULL).
+       The expander widget calls this with NULL before the expander is removed
+       from the engine, which waits for the current engine step, so no Mixer
+       runs the expander once it is deleted */
+    static void unlink(MixerModule *expander, MixerModule *left = NULL) {
+	for(MixerModule *m : instances()) {
+	    if(m == left)
+		continue;
+	    MixerModule *expected = expander;
+	    m->right.compare_exchange_strong(expected, nullptr);
+	}
+    }
+
+    virtual void processMuteButtons() {}
+    virtual void processChannels(float *sums) {}
+};
+
+/* CHANNELS channel strips, all loops over channels and lanes have compile
+   time bounds. The ids of the channel params, inputs and lights start at the
+   given offsets */
+template <int CHANNELS, int PARAM_OFFSET, int INPUT_OFFSET, int LIGHT_OFFSET>
+struct MixerChannels : MixerModule {
+    //channel filters run in a structure of arrays bank padded to a multiple of 4 lanes
+    static const int NUM_CHANNELS = CHANNELS;
+    static const int NUM_LANES = (CHANNELS + 3) / 4 * 4;
+
+    enum ChannelParamIds {
+	GAIN_PARAM = PARAM_OFFSET,
+	MUTE_PARAM = GAIN_PARAM + CHANNELS,
+	EQ_LOW_PARAM = MUTE_PARAM + CHANNELS,
+	EQ_MID_PARAM = EQ_LOW_PARAM + CHANNELS,
+	EQ_HIGH_PARAM = EQ_MID_PARAM + CHANNELS,
+	PAN_PARAM = EQ_HIGH_PARAM + CHANNELS,
+	AUX1_PARAM = PAN_PARAM + CHANNELS,
+	AUX2_PARAM = AUX1_PARAM + CHANNELS,
+	CHANNEL_PARAMS_END = AUX2_PARAM + CHANNELS
+    };
+    enum ChannelInputIds {
+	CH1_INPUT = INPUT_OFFSET,
+	CH1_GAIN_INPUT = CH1_INPUT + CHANNELS,
+	CH1_PAN_INPUT = CH1_GAIN_INPUT + CHANNELS,
+	CHANNEL_INPUTS_END = CH1_PAN_INPUT + CHANNELS
+    };
+    enum ChannelLightIds {
+	MUTE_LIGHT = LIGHT_OFFSET,
+	CHANNEL_LIGHTS_END = MUTE_LIGHT + CHANNELS
+    };
 
-#define NUM_CHANNELS 6
+    MixerChannels(int numParams, int numInputs, int numOutputs, int numLights) : MixerModule(numParams, numInputs, numOutputs, numLights) {
+	channelLowTable.update();
+	channelMidTable.update();
+	channelHighTable.update();
+	eqLow.table = &channelLowTable;
+	eqMid.table = &channelMidTable;
+	eqHigh.table = &channelHighTable;
+	setChannelFilters();
+    }
+
+    void setChannelFilters() {
+	AeFilter chHp;
+	AeEqualizer chHs;
+	chHp.setCutoff(35.0f, 0.8f, AeFilterType::AeHIGHPASS);
+	chHs.setParams(12000.0f, 0.8f, -5.0f, AeEQType::AeHIGHSHELVE);
+	hpHs.setCoefficients(chHp, chHs);
+    }
+
+    void onSampleRateChange() override {
+	channelLowTable.update();
+	channelMidTable.update();
+	channelHighTable.update();
+	setChannelFilters();
+
+	//force a coefficient update on the next step
+	for(int i=0;i<CHANNELS;i++) {
+	    channels[i].lastLowGain = -25.0f;
+	    channels[i].lastMidGain = -25.0f;
+	    channels[i].lastHighGain = -25.0f;
+	}
+    }
+
+    //per channel control state, the audio state lives in the filter banks below
+    struct mixerChannel {
+	//initialize out of range so it passes the check on initialisation
+	float lastGain = 1000.0f;
+	float lastLowGain = -25.0f;
+	float lastMidGain = -25.0f;
+	float lastHighGain = -25.0f;
+	bool mute = false;
+
+	int silentSamples = 0;
+	bool silent = false;
+	//sendGain needs to be recomputed every sample (ramps running or CV patched)
+	bool moving = false;
+    };
+
+    //linear ramps from the last to the current block value, per lane
+    struct laneRamp {
+	float value[NUM_LANES] = {};
+	float target[NUM_LANES] = {};
+	float delta[NUM_LANES] = {};
+
+	//returns true if the ramp is moving in this block
+	bool setTarget(int lane, float t) {
+	    value[lane] = target[lane];
+	    target[lane] = t;
+	    delta[lane] = (t - value[lane]) / PARAM_BLOCK;
+	    return delta[lane] != 0.0f;
+	}
+
+	void jump(int lane, float t) {
+	    value[lane] = target[lane] = t;
+	    delta[lane] = 0.0f;
+	}
+
+	void process() {
+	    for(int i=0;i<NUM_LANES;i++) {
+		value[i] += delta[i];
+	    }
+	}
+    };
+
+    mixerChannel channels[CHANNELS];
+    SchmittTrigger muteTrigger[CHANNELS];
+
+    //channel strips (one lane per channel)
+    AeEqualizerBank<NUM_LANES> eqLow;
+    AeEqualizerBank<NUM_LANES> eqMid;
+    AeEqualizerBank<NUM_LANES> eqHigh;
+    //fixed 35Hz highpass and 12kHz high shelve
+    AeBiquadPairBank<NUM_LANES> hpHs;
+    float laneIn[NUM_LANES] = {};
+    laneRamp gainRamp;
+    laneRamp panRamp;
+    laneRamp aux1Ramp;
+    laneRamp aux2Ramp;
+    float sendGain[NUM_SENDS][NUM_LANES] = {};
+
+    int paramFrame = 0;
+
+    bool isSilent(int lane) {
+	return eqLow.isSilent(lane, SILENCE_THRESHOLD) && eqMid.isSilent(lane, SILENCE_THRESHOLD) && eqHigh.isSilent(lane, SILENCE_THRESHOLD)
+	    && hpHs.isSilent(lane, SILENCE_THRESHOLD);
+    }
+
+    void initLane(int lane) {
+	eqLow.init(lane);
+	eqMid.init(lane);
+	eqHigh.init(lane);
+	hpHs.init(lane);
+    }
+
+    //bit i is set if channel i is patched and not muted
+    int activeMask = 0;
+    //indices of the active channels, only these are processed
+    int activeChannels[CHANNELS] = {};
+    int numActive = 0;
+
+    void updateActiveChannels(int mask);
+    void processChannelParams();
+    void updateSendGains(int lane);
+    void processMuteButtons() override;
+    void processChannels(float *sums) override;
+};
+
+/* Called when connections or mute states changed */
+template <int CHANNELS, int PARAM_OFFSET, int INPUT_OFFSET, int LIGHT_OFFSET>
+void MixerChannels<CHANNELS, PARAM_OFFSET, INPUT_OFFSET, LIGHT_OFFSET>::updateActiveChannels(int mask) {
+    numActive = 0;
+    for(int i=0;i<CHANNELS;i++) {
+	bool isActive = mask & (1 << i);
+	bool wasActive = activeMask & (1 << i);
+
+	if(isActive) {
+	    activeChannels[numActive++] = i;
+	    if(!wasActive) {
+		//don't resume with the stale state from before the channel was muted/unpatched
+		initLane(i);
+		channels[i].silent = false;
+		channels[i].silentSamples = 0;
+		//parameters were not read while inactive, fade in from zero with the next block
+		channels[i].lastGain = 1000.0f;
+		channels[i].lastLowGain = -25.0f;
+		channels[i].lastMidGain = -25.0f;
+		channels[i].lastHighGain = -25.0f;
+		gainRamp.jump(i, 0.0f);
+		panRamp.jump(i, params[PAN_PARAM + i].value);
+		aux1Ramp.jump(i, params[AUX1_PARAM + i].value);
+		aux2Ramp.jump(i, params[AUX2_PARAM + i].value);
+	    }
+	}
+	else {
+	    laneIn[i] = 0.0f;
+	    for(int s=0;s<NUM_SENDS;s++) {
+		sendGain[s][i] = 0.0f;
+	    }
+	    channels[i].moving = false;
+	}
+    }
+    activeMask = mask;
+}
+
+/* Read the channel knobs (once per PARAM_BLOCK) and set up the ramps for the next block */
+template <int CHANNELS, int PARAM_OFFSET, int INPUT_OFFSET, int LIGHT_OFFSET>
+void MixerChannels<CHANNELS, PARAM_OFFSET, INPUT_OFFSET, LIGHT_OFFSET>::processChannelParams() {
+    for(int k=0;k<numActive;k++) {
+	int i = activeChannels[k];
+	bool moving = false;
+
+	//the table lookup is only needed when the knob moved
+	float gainParam = params[GAIN_PARAM + i].value;
+	float gain = gainRamp.target[i];
+	if(gainParam != channels[i].lastGain) {
+	    channels[i].lastGain = gainParam;
+	    gain = dbToGain(gainParam);
+	}
+	moving |= gainRamp.setTarget(i, gain);
+	moving |= panRamp.setTarget(i, params[PAN_PARAM + i].value);
+	moving |= aux1Ramp.setTarget(i, params[AUX1_PARAM + i].value);
+	moving |= aux2Ramp.setTarget(i, params[AUX2_PARAM + i].value);
+	channels[i].moving |= moving;
+
+	float lowGain = params[EQ_LOW_PARAM + i].value;
+	float midGain = params[EQ_MID_PARAM + i].value;
+	float highGain = params[EQ_HIGH_PARAM + i].value;
+
+	//only update coefficients when neccessary
+	if(lowGain != channels[i].lastLowGain) {
+	    eqLow.setGain(i, lowGain);
+	    channels[i].lastLowGain = lowGain;
+	}
+	if(midGain != channels[i].lastMidGain) {
+	    eqMid.setGain(i, midGain);
+	    channels[i].lastMidGain = midGain;
+	}
+	if(highGain != channels[i].lastHighGain) {
+	    eqHigh.setGain(i, highGain);
+	    channels[i].lastHighGain = highGain;
+	}
+    }
+}
+
+/* Gain matrix of one channel from the current ramp values and CV */
+template <int CHANNELS, int PARAM_OFFSET, int INPUT_OFFSET, int LIGHT_OFFSET>
+inline void MixerChannels<CHANNELS, PARAM_OFFSET, INPUT_OFFSET, LIGHT_OFFSET>::updateSendGains(int i) {
+    float gain = gainRamp.value[i] * inputs[CH1_GAIN_INPUT + i].normalize(10.0f) / 10.0f;
+    float pan = clamp(panRamp.value[i] + inputs[CH1_PAN_INPUT + i].value /5.0f, -1.0f, 1.0f);
+
+    float gainL = (pan < 0) ? gain : gain * (1 - pan);
+    float gainR = (pan > 0) ? gain : gain * (1 + pan);
+    sendGain[SEND_L][i] = gainL;
+    sendGain[SEND_R][i] = gainR;
+    sendGain[SEND_AUX1_L][i] = gainL * aux1Ramp.value[i];
+    sendGain[SEND_AUX1_R][i] = gainR * aux1Ramp.value[i];
+    sendGain[SEND_AUX2_L][i] = gainL * aux2Ramp.value[i];
+    sendGain[SEND_AUX2_R][i] = gainR * aux2Ramp.value[i];
+}
+
+template <int CHANNELS, int PARAM_OFFSET, int INPUT_OFFSET, int LIGHT_OFFSET>
+void MixerChannels<CHANNELS, PARAM_OFFSET, INPUT_OFFSET, LIGHT_OFFSET>::processMuteButtons() {
+    for(int i=0;i<CHANNELS;i++) {
+	if(muteTrigger[i].process(params[MUTE_PARAM + i].value)) {
+	    channels[i].mute = !channels[i].mute;
+	    lights[MUTE_LIGHT + i].value =  (channels[i].mute) ? 1.0f : 0.0f;
+	}
+    }
+}
+
+/* Runs all channel strips for one frame and adds them to sums[NUM_SENDS] */
+template <int CHANNELS, int PARAM_OFFSET, int INPUT_OFFSET, int LIGHT_OFFSET>
+void MixerChannels<CHANNELS, PARAM_OFFSET, INPUT_OFFSET, LIGHT_OFFSET>::processChannels(float *sums) {
+    processMuteButtons();
+    int mask = 0;
+    for(int i=0;i<CHANNELS;i++) {
+	if(inputs[CH1_INPUT + i].active && !channels[i].mute)
+	    mask |= 1 << i;
+    }
+    if(mask != activeMask)
+	updateActiveChannels(mask);
+
+    if(paramFrame == 0)
+	processChannelParams();
+    bool lastFrame = (++paramFrame >= PARAM_BLOCK);
+    if(lastFrame)
+	paramFrame = 0;
+
+    //gather inputs and update the gain matrix for the active lanes
+    bool active = false;
+    for(int k=0;k<numActive;k++) {
+	int i = activeChannels[k];
+	float in = inputs[CH1_INPUT + i].value;
+
+	//silence detection: stop feeding the lane once everything decayed.
+	//The state is (almost) zero by then, so clearing it doesn't click on resume
+	if(fabsf(in) < SILENCE_THRESHOLD) {
+	    if(!channels[i].silent && ++channels[i].silentSamples >= SILENCE_SAMPLES && isSilent(i)) {
+		channels[i].silent = true;
+		initLane(i);
+	    }
+	}
+	else {
+	    channels[i].silentSamples = 0;
+	    channels[i].silent = false;
+	}
+
+	laneIn[i] = channels[i].silent ? 0.0f : in;
+	active |= !channels[i].silent;
+
+	//the matrix only changes while ramping or with CV
+	if(channels[i].moving || inputs[CH1_GAIN_INPUT + i].active || inputs[CH1_PAN_INPUT + i].active) {
+	    updateSendGains(i);
+	    if(lastFrame && gainRamp.delta[i] == 0.0f && panRamp.delta[i] == 0.0f && aux1Ramp.delta[i] == 0.0f && aux2Ramp.delta[i] == 0.0f)
+		channels[i].moving = false;
+	}
+    }
+    gainRamp.process();
+    panRamp.process();
+    aux1Ramp.process();
+    aux2Ramp.process();
+
+    if(!active)
+	return;
+
+    //run all channel strips at once and apply the gain matrix
+    //the banks filter in place, keep laneIn for inactive lanes (only zeroed on deactivation)
+    float lane[NUM_LANES];
+    for(int i=0;i<NUM_LANES;i++) {
+	lane[i] = laneIn[i];
+    }
+    //flat bands are skipped
+    eqLow.process(lane, activeMask);
+    eqMid.process(lane, activeMask);
+    eqHigh.process(lane, activeMask);
+    hpHs.process(lane);
+
+    for(int s=0;s<NUM_SENDS;s++) {
+	for(int i=0;i<NUM_LANES;i++) {
+	    sums[s] += lane[i] * sendGain[s][i];
+	}
+    }
+}
+
+/* Mixer with CHANNELS channel strips and the master section. The channel
+   params and inputs follow the master ones, the mute lights come first */
+template <int CHANNELS>
+struct Mixer : MixerChannels<CHANNELS, 4, 4, 0> {
+    typedef MixerChannels<CHANNELS, 4, 4, 0> Channels;
 
-struct Mixer : Module {
     enum ParamIds {
 	MASTER_GAIN_PARAM,
 	MASTER_EQ_LOW_PARAM,
 	MASTER_EQ_MID_PARAM,
 	MASTER_EQ_HIGH_PARAM,
-	GAIN_PARAM,
-	MUTE_PARAM = GAIN_PARAM + NUM_CHANNELS,
-	EQ_LOW_PARAM = MUTE_PARAM + NUM_CHANNELS,
-	EQ_MID_PARAM = EQ_LOW_PARAM + NUM_CHANNELS,
-	EQ_HIGH_PARAM = EQ_MID_PARAM + NUM_CHANNELS,
-	PAN_PARAM = EQ_HIGH_PARAM + NUM_CHANNELS,
-	AUX1_PARAM = PAN_PARAM + NUM_CHANNELS,
-	AUX2_PARAM = AUX1_PARAM + NUM_CHANNELS,
-	NUM_PARAMS = AUX2_PARAM + NUM_CHANNELS
+	NUM_PARAMS = Channels::CHANNEL_PARAMS_END
     };
     enum InputIds {
 	AUX1_L_INPUT,
 	AUX1_R_INPUT,
 	AUX2_L_INPUT,
 	AUX2_R_INPUT,
-	CH1_INPUT,
-	CH1_GAIN_INPUT = CH1_INPUT + NUM_CHANNELS,
-	CH1_PAN_INPUT = CH1_GAIN_INPUT + NUM_CHANNELS,
-	NUM_INPUTS = CH1_PAN_INPUT + NUM_CHANNELS
+	NUM_INPUTS = Channels::CHANNEL_INPUTS_END
     };
     enum OutputIds {
 	L_OUTPUT,
@@ -41,43 +434,127 @@ struct Mixer : Module {
 	NUM_OUTPUTS
     };
     enum LightIds {
-	MUTE_LIGHT,
-	METER_L_LIGHT = MUTE_LIGHT + NUM_CHANNELS,
+	METER_L_LIGHT = Channels::CHANNEL_LIGHTS_END,
 	METER_R_LIGHT = METER_L_LIGHT + 6,
 	NUM_LIGHTS = METER_R_LIGHT + 6
     };
+    static_assert(MASTER_EQ_HIGH_PARAM + 1 == (int)Channels::GAIN_PARAM, "channel params must follow the master params");
+    static_assert(AUX2_R_INPUT + 1 == (int)Channels::CH1_INPUT, "channel inputs must follow the aux inputs");
 
-    Mixer() : Module(NUM_PARAMS, NUM_INPUTS, NUM_OUTPUTS, NUM_LIGHTS) {
+    Mixer() : Channels(NUM_PARAMS, NUM_INPUTS, NUM_OUTPUTS, NUM_LIGHTS) {
+	masterLowTable.update();
+	masterMidTable.update();
+	masterHighTable.update();
 
-	for(int i=0;i<NUM_CHANNELS;i++) {
-	    channels[i].hp.setCutoff(35.0f, 0.8f, AeFilterType::AeHIGHPASS);
-	    channels[i].hs.setParams(12000.0f, 0.8f, -5.0f, AeEQType::AeHIGHSHELVE);
-	}
+	setMasterFilters();
+	setMeterHoldTime();
+	meter.dBInterval = 10.0f;
+    }
 
+    void setMasterFilters() {
 	maHp.setCutoff(35.0f, 0.8f, AeFilterType::AeHIGHPASS);
 	maHs.setParams(12000.0f, 0.8f, -2.0f, AeEQType::AeHIGHSHELVE);
+    }
 
-	meter.dBInterval = 10.0f;
+    void onSampleRateChange() override {
+	Channels::onSampleRateChange();
+	masterLowTable.update();
+	masterMidTable.update();
+	masterHighTable.update();
+	setMasterFilters();
+	setMeterHoldTime();
+
+	//force a coefficient update on the next step
+	lastMaLowGain = -25.0f;
+	lastMaMidGain = -25.0f;
+	lastMaHighGain = -25.0f;
     }
 
-    struct mixerChannel {
-	AeEqualizer eqLow;
-	AeEqualizer eqMid;
-	AeEqualizer eqHigh;
+    float lastMasterGain = 1000.0f;
+    float masterGain = 0.0f;
+    float masterGainTarget = 0.0f;
+    float masterGainDelta = 0.0f;
 
-	AeFilter hp;
-	AeEqualizer hs;
+    void processParams();
 
-	//initialize out of range so it passes the check on initialisation
-	float lastLowGain = -25.0f;
-	float lastMidGain = -25.0f;
-	float lastHighGain = -25.0f;
-	bool mute = false;
+    /* Accumulates peak, true peak and mean square over one METER_BLOCK */
+    struct blockMeter {
+	float peak = 0.0f;
+	float truePeak = 0.0f;
+	float sumSquares = 0.0f;
+	float hold = 0.0f;
+	int holdBlocks = 0;
+
+	void process(float x) {
+	    peak = fmaxf(peak, fabsf(x));
+	    sumSquares += x * x;
+	}
+
+	//x: TRUE_PEAK_FACTOR oversampled frames of one sample
+	void processTruePeak(const float *x) {
+	    for(int i=0;i<TRUE_PEAK_FACTOR;i++) {
+		truePeak = fmaxf(truePeak, fabsf(x[i]));
+	    }
+	}
+
+	//peak of the last finished block (the true peak if it was measured)
+	float lastPeak = 0.0f;
+
+	/* returns the level of the finished block and starts a new one. With
+	   useTruePeak peak readings (the level in peak mode and the hold) use
+	   the true peak. The hold lasts holdTime blocks */
+	float update(bool rms, bool useTruePeak, int holdTime) {
+	    lastPeak = useTruePeak ? fmaxf(truePeak, peak) : peak;
+	    float level = rms ? sqrtf(sumSquares / METER_BLOCK) : lastPeak;
+	    float holdLevel = useTruePeak ? lastPeak : level;
+	    if(holdLevel >= hold || --holdBlocks <= 0) {
+		hold = holdLevel;
+		holdBlocks = holdTime;
+	    }
+	    peak = 0.0f;
+	    truePeak = 0.0f;
+	    sumSquares = 0.0f;
+	    return level;
+	}
     };
 
-    mixerChannel channels[NUM_CHANNELS];
     VUMeter meter;
-    SchmittTrigger muteTrigger[NUM_CHANNELS];
+    blockMeter meterL;
+    blockMeter meterR;
+    int meterFrame = 0;
+    bool peakHold = false;
+    bool rmsMeter = false;
+    //peak readings include inter-sample peaks, detected on the oversampled output
+    bool truePeak = false;
+    AeOversampler<2> truePeakUpsampler {TRUE_PEAK_FACTOR};
+    //METER_HOLD_TIME in meter blocks
+    int meterHoldBlocks = 1;
+
+    void setMeterHoldTime() {
+	meterHoldBlocks = std::max((int)roundf(METER_HOLD_TIME * engineGetSampleRate() / METER_BLOCK), 1);
+    }
+
+    void updateMeterLights(blockMeter &m, int firstLight);
+
+    json_t *toJson() override {
+	json_t *rootJ = json_object();
+	json_object_set_new(rootJ, "peakHold", json_boolean(peakHold));
+	json_object_set_new(rootJ, "rmsMeter", json_boolean(rmsMeter));
+	json_object_set_new(rootJ, "truePeak", json_boolean(truePeak));
+	return rootJ;
+    }
+
+    void fromJson(json_t *rootJ) override {
+	json_t *peakHoldJ = json_object_get(rootJ, "peakHold");
+	if(peakHoldJ)
+	    peakHold = json_boolean_value(peakHoldJ);
+	json_t *rmsMeterJ = json_object_get(rootJ, "rmsMeter");
+	if(rmsMeterJ)
+	    rmsMeter = json_boolean_value(rmsMeterJ);
+	json_t *truePeakJ = json_object_get(rootJ, "truePeak");
+	if(truePeakJ)
+	    truePeak = json_boolean_value(truePeakJ);
+    }
 
     //master EQ
     AeEqualizerStereo eqMaLow;
@@ -92,90 +569,55 @@ struct Mixer : Module {
     void step() override;
 };
 
-
-void Mixer::step() {
-
-    float outL = 0.0f;
-    float outR = 0.0f;
-    float aux1L = 0.0f;
-    float aux1R = 0.0f;
-    float aux2L = 0.0f;
-    float aux2R = 0.0f;
-
-    float masterGain = params[MASTER_GAIN_PARAM].value;
-    masterGain = pow(10, masterGain/20);
-
-    float aux1LIn = inputs[AUX1_L_INPUT].normalize(0.0f);
-    float aux1RIn = inputs[AUX1_R_INPUT].normalize(0.0f);
-    float aux2LIn = inputs[AUX2_L_INPUT].normalize(0.0f);
-    float aux2RIn = inputs[AUX2_R_INPUT].normalize(0.0f);
-
-    for(int i=0;i<NUM_CHANNELS;i++) {
-	float in = inputs[CH1_INPUT + i].value;
-
-	if(muteTrigger[i].process(params[MUTE_PARAM + i].value)) {
-	    channels[i].mute = !channels[i].mute;
-	    lights[MUTE_LIGHT + i].value =  (channels[i].mute) ? 1.0f : 0.0f;
-	}
-
-	if(!channels[i].mute) {
-	    float gain = pow(10, params[GAIN_PARAM + i].value/20.0f);
-	    gain *= inputs[CH1_GAIN_INPUT + i].normalize(10.0f) / 10.0f;
-
-	    float pan = clamp(params[PAN_PARAM + i].value + inputs[CH1_PAN_INPUT + i].value /5.0f, -1.0f, 1.0f);
-	    float lowGain = params[EQ_LOW_PARAM + i].value;
-	    float midGain = params[EQ_MID_PARAM + i].value;
-	    float highGain = params[EQ_HIGH_PARAM + i].value;
-
-	    //only calculate coefficients when neccessary
-	    if(lowGain != channels[i].lastLowGain) {
-		channels[i].eqLow.setParams(125.0f, 0.45f, lowGain, AeEQType::AeLOWSHELVE);
-		channels[i].lastLowGain = lowGain;
-	    }
-	    if(midGain != channels[i].lastMidGain) {
-		channels[i].eqMid.setParams(1200.0f, 0.52f, midGain, AeEQType::AePEAKINGEQ);
-		channels[i].lastMidGain = midGain;
-	    }
-	    if(highGain != channels[i].lastHighGain) {
-		channels[i].eqHigh.setParams(1800.0f, 0.4f, highGain, AeEQType::AeHIGHSHELVE);
-		channels[i].lastHighGain = highGain;
-	    }
-
-	    float out = channels[i].eqLow.process(in);
-	    out = channels[i].eqMid.process(out);
-	    out = channels[i].eqHigh.process(out);
-	    out = channels[i].hp.process(out);
-	    out = channels[i].hs.process(out);
-
-	    float leftGain = (pan < 0) ? gain : gain * (1 - pan);
-	    float rightGain = (pan > 0) ? gain : gain * (1 + pan);
-
-	    //outputs
-	    //out = tanh(out) * 5.0f;
-	    //out *= 5.0f;
-	    outL += out * leftGain;
-	    outR += out * rightGain;
-	    aux1L += out * leftGain * params[AUX1_PARAM + i].value;
-	    aux1R += out * rightGain * params[AUX1_PARAM + i].value;
-	    aux2L += out * leftGain * params[AUX2_PARAM + i].value;
-	    aux2R += out * rightGain * params[AUX2_PARAM + i].value;
-	}
+/* Read the master knobs (once per PARAM_BLOCK) */
+template <int CHANNELS>
+void Mixer<CHANNELS>::processParams() {
+    masterGain = masterGainTarget;
+    if(this->params[MASTER_GAIN_PARAM].value != lastMasterGain) {
+	lastMasterGain = this->params[MASTER_GAIN_PARAM].value;
+	masterGainTarget = dbToGain(lastMasterGain);
     }
+    masterGainDelta = (masterGainTarget - masterGain) / PARAM_BLOCK;
 
-    //master EQ
-    if(lastMaLowGain != params[MASTER_EQ_LOW_PARAM].value) {
-	lastMaLowGain = params[MASTER_EQ_LOW_PARAM].value;
-	eqMaLow.setParams(120.0f, 0.45f, lastMaLowGain, AeEQType::AeLOWSHELVE);
+    if(lastMaLowGain != this->params[MASTER_EQ_LOW_PARAM].value) {
+	lastMaLowGain = this->params[MASTER_EQ_LOW_PARAM].value;
+	eqMaLow.setParams(masterLowTable.lookup(lastMaLowGain));
     }
-    if(lastMaMidGain != params[MASTER_EQ_MID_PARAM].value) {
-	lastMaMidGain = params[MASTER_EQ_MID_PARAM].value;
-	eqMaMid.setParams(1300.0f, 0.95f, lastMaMidGain, AeEQType::AePEAKINGEQ);
+    if(lastMaMidGain != this->params[MASTER_EQ_MID_PARAM].value) {
+	lastMaMidGain = this->params[MASTER_EQ_MID_PARAM].value;
+	eqMaMid.setParams(masterMidTable.lookup(lastMaMidGain));
     }
-    if(lastMaHighGain != params[MASTER_EQ_HIGH_PARAM].value) {
-	lastMaHighGain = params[MASTER_EQ_HIGH_PARAM].value;
-	eqMaHigh.setParams(1700.0f, 0.45f, lastMaHighGain, AeEQType::AeHIGHSHELVE);
+    if(lastMaHighGain != this->params[MASTER_EQ_HIGH_PARAM].value) {
+	lastMaHighGain = this->params[MASTER_EQ_HIGH_PARAM].value;
+	eqMaHigh.setParams(masterHighTable.lookup(lastMaHighGain));
     }
+}
 
+template <int CHANNELS>
+void Mixer<CHANNELS>::step() {
+    float aux1LIn = this->inputs[AUX1_L_INPUT].normalize(0.0f);
+    float aux1RIn = this->inputs[AUX1_R_INPUT].normalize(0.0f);
+    float aux2LIn = this->inputs[AUX2_L_INPUT].normalize(0.0f);
+    float aux2RIn = this->inputs[AUX2_R_INPUT].normalize(0.0f);
+
+    if(this->paramFrame == 0)
+	processParams();
+
+    float sums[NUM_SENDS] = {};
+    this->processChannels(sums);
+
+    //run the expanders. Rack copies all cables after stepping the modules, so
+    //their inputs belong to the same frame as ours whatever the module order
+    MixerModule *expander = this->right.load(std::memory_order_acquire);
+    for(int i=0;expander && i<MAX_EXPANDERS;i++) {
+	expander->processChannels(sums);
+	expander->pulled = true;
+	expander = expander->right.load(std::memory_order_acquire);
+    }
+    float outL = sums[SEND_L];
+    float outR = sums[SEND_R];
+
+    //master EQ
     eqMaLow.process(&outL, &outR);
     eqMaMid.process(&outL, &outR);
     eqMaHigh.process(&outL, &outR);
@@ -185,72 +627,298 @@ void Mixer::step() {
     //outputs
     outL = (outL + aux1LIn + aux2LIn) * masterGain;
     outR = (outR + aux1RIn + aux2RIn) * masterGain;
-    outputs[L_OUTPUT].value = outL;
-    outputs[R_OUTPUT].value = outR;
-    outputs[AUX1_L_OUTPUT].value = aux1L;
-    outputs[AUX1_R_OUTPUT].value = aux1R;
-    outputs[AUX2_L_OUTPUT].value = aux2L;
-    outputs[AUX2_R_OUTPUT].value = aux2R;
+    masterGain += masterGainDelta;
+    this->outputs[L_OUTPUT].value = outL;
+    this->outputs[R_OUTPUT].value = outR;
+    this->outputs[AUX1_L_OUTPUT].value = sums[SEND_AUX1_L];
+    this->outputs[AUX1_R_OUTPUT].value = sums[SEND_AUX1_R];
+    this->outputs[AUX2_L_OUTPUT].value = sums[SEND_AUX2_L];
+    this->outputs[AUX2_R_OUTPUT].value = sums[SEND_AUX2_R];
 
     //meter
-    for (int i = 0; i < 6; i++){
-	meter.setValue(outL / 5.0f);
-	lights[METER_L_LIGHT + i].setBrightnessSmooth(meter.getBrightness(i));
-	meter.setValue(outR / 5.0f);
-	lights[METER_R_LIGHT + i].setBrightnessSmooth(meter.getBrightness(i));
+    meterL.process(outL);
+    meterR.process(outR);
+    if(truePeak) {
+	float in[2] = {outL, outR};
+	float up[TRUE_PEAK_FACTOR][2];
+	truePeakUpsampler.upsample(in, up);
+	float upL[TRUE_PEAK_FACTOR], upR[TRUE_PEAK_FACTOR];
+	for(int i=0;i<TRUE_PEAK_FACTOR;i++) {
+	    upL[i] = up[i][0];
+	    upR[i] = up[i][1];
+	}
+	meterL.processTruePeak(upL);
+	meterR.processTruePeak(upR);
+    }
+    if(++meterFrame >= METER_BLOCK) {
+	updateMeterLights(meterL, METER_L_LIGHT);
+	updateMeterLights(meterR, METER_R_LIGHT);
+	meterFrame = 0;
+    }
+}
+
+template <int CHANNELS>
+void Mixer<CHANNELS>::updateMeterLights(blockMeter &m, int firstLight) {
+    meter.setValue(m.update(rmsMeter, truePeak, meterHoldBlocks) / 5.0f);
+    float brightness[6];
+    for(int i=0;i<6;i++) {
+	brightness[i] = meter.getBrightness(i);
+    }
+    //the hold, or on an RMS meter the true peak of the block
+    if(peakHold || (truePeak && rmsMeter)) {
+	//light the topmost segment the marked level reaches (lights are ordered top to bottom)
+	meter.setValue((peakHold ? m.hold : m.lastPeak) / 5.0f);
+	for(int i=0;i<6;i++) {
+	    if(meter.getBrightness(i) > 0.0f) {
+		brightness[i] = 1.0f;
+		break;
+	    }
+	}
+    }
+    for(int i=0;i<6;i++) {
+	this->lights[firstLight + i].setBrightnessSmooth(brightness[i], METER_BLOCK);
+    }
+}
+
+/* Channel strips without a master section. Placed right of a Mixer (or of
+   another expander) their strips are run by the Mixer and summed before its
+   master section, sample aligned with the Mixer's own channels */
+template <int CHANNELS>
+struct MixerExpander : MixerChannels<CHANNELS, 0, 0, 0> {
+    typedef MixerChannels<CHANNELS, 0, 0, 0> Channels;
+
+    enum ParamIds {
+	NUM_PARAMS = Channels::CHANNEL_PARAMS_END
+    };
+    enum InputIds {
+	NUM_INPUTS = Channels::CHANNEL_INPUTS_END
+    };
+    enum OutputIds {
+	NUM_OUTPUTS
+    };
+    enum LightIds {
+	LINK_LIGHT = Channels::CHANNEL_LIGHTS_END,
+	NUM_LIGHTS
+    };
+
+    MixerExpander() : Channels(NUM_PARAMS, NUM_INPUTS, NUM_OUTPUTS, NUM_LIGHTS) {}
+
+    void step() override {
+	//a linked Mixer handles everything else, keep the mute buttons working without one
+	if(!this->pulled)
+	    this->processMuteButtons();
+	this->lights[LINK_LIGHT].value = this->pulled ? 1.0f : 0.0f;
+	this->pulled = false;
+    }
+};
+
+/* Returns the Mixer or expander directly left of w (if any) */
+static MixerModule *findLeftMixer(ModuleWidget *w) {
+    for(Widget *child : gRackWidget->moduleContainer->children) {
+	ModuleWidget *left = dynamic_cast<ModuleWidget*>(child);
+	if(!left || left == w || left->box.pos.y != w->box.pos.y)
+	    continue;
+	if(fabsf(left->box.pos.x + left->box.size.x - w->box.pos.x) < 1.0f)
+	    return dynamic_cast<MixerModule*>(left->module);
+    }
+    return nullptr;
+}
+
+//channel inputs are arranged in blocks of 6 rows on the left
+#define MIXER_INPUT_ROWS 6
+
+/* Adds the channel strips of M starting at stripX, their inputs go in blocks of 6 rows on the left */
+template <class M>
+static void addMixerChannels(ModuleWidget *w, Module *module, float stripX) {
+    for(int i=0;i<M::NUM_CHANNELS;i++) {
+	float x = stripX + i * 48;
+	w->addParam(ParamWidget::create<BefacoWhiteKnob>(Vec(x, 10), module, M::AUX1_PARAM + i, 0.0f, 1.0f, 0.0f));
+	w->addParam(ParamWidget::create<BefacoWhiteKnob>(Vec(x, 57), module, M::AUX2_PARAM + i, 0.0f, 1.0f, 0.0f));
+	w->addParam(ParamWidget::create<BefacoWhiteKnob>(Vec(x, 104), module, M::PAN_PARAM + i, -1.0f, 1.0f, 0.0f));
+	w->addParam(ParamWidget::create<BefacoDarkKnob>(Vec(x, 151), module, M::EQ_HIGH_PARAM + i, -15.0f, 15.0f, 0.0f));
+	w->addParam(ParamWidget::create<BefacoDarkKnob>(Vec(x, 198), module, M::EQ_MID_PARAM + i, -12.5f, 12.5f, 0.0f));
+	w->addParam(ParamWidget::create<BefacoDarkKnob>(Vec(x, 245), module, M::EQ_LOW_PARAM + i, -20.0f, 20.0f, 0.0f));
+
+	w->addParam(ParamWidget::create<BefacoPush>(Vec(x + 3, 290), module, M::MUTE_PARAM + i, 0.0f, 1.0f, 0.0f));
+	w->addChild(ModuleLightWidget::create<SmallLight<RedLight>>(Vec(x - 1, 288), module, M::MUTE_LIGHT + i));
+	w->addParam(ParamWidget::create<BefacoRedKnob>(Vec(x, 330), module, M::GAIN_PARAM + i, -60.0f, 0.0f, -6.0f));
+
+	float inputX = 5 + (i / MIXER_INPUT_ROWS) * 95;
+	float inputY = 25 + (i % MIXER_INPUT_ROWS) * 30;
+	w->addInput(Port::create<PJ301MPort>(Vec(inputX, inputY), Port::INPUT, module, M::CH1_INPUT + i));
+	w->addInput(Port::create<PJ301MPort>(Vec(inputX + 30, inputY), Port::INPUT, module, M::CH1_GAIN_INPUT + i));
+	w->addInput(Port::create<PJ301MPort>(Vec(inputX + 60, inputY), Port::INPUT, module, M::CH1_PAN_INPUT + i));
     }
 }
 
+/* Labels for the strips and inputs added by addMixerChannels, the row labels
+   go under the first strip */
+template <class M>
+static void addMixerLabels(ModuleWidget *w, float stripX) {
+    static const float rowY[] = {10, 57, 104, 151, 198, 245};
+    static const char *rowLabels[] = {"AUX 1", "AUX 2", "PAN", "HIGH", "MID", "LOW"};
+    for(int r=0;r<6;r++) {
+	addPanelLabel(w, Vec(stripX + 16, rowY[r] + 41), rowLabels[r]);
+    }
+    addPanelLabel(w, Vec(stripX + 16, 326), "GAIN");
+
+    for(int i=0;i<M::NUM_CHANNELS;i++) {
+	addPanelLabel(w, Vec(stripX + i * 48 + 16, 374), std::to_string(i + 1));
+
+	float inputX = 5 + (i / MIXER_INPUT_ROWS) * 95;
+	float inputY = 25 + (i % MIXER_INPUT_ROWS) * 30;
+	addPanelLabel(w, Vec(inputX + 89.5f, inputY + 15), std::to_string(i + 1));
+	if(i % MIXER_INPUT_ROWS == 0) {
+	    addPanelLabel(w, Vec(inputX + 12, 20), "IN");
+	    addPanelLabel(w, Vec(inputX + 42, 20), "GAIN");
+	    addPanelLabel(w, Vec(inputX + 72, 20), "PAN");
+	}
+    }
+}
+
+/* Plain panel for the variants without artwork */
+static void addMixerPanel(ModuleWidget *w, float width) {
+    w->box.size = Vec(ceilf(width / RACK_GRID_WIDTH) * RACK_GRID_WIDTH, RACK_GRID_HEIGHT);
+    Panel *panel = new Panel();
+    panel->backgroundColor = nvgRGB(0x17, 0x17, 0x17);
+    panel->box.size = w->box.size;
+    w->addChild(panel);
+}
+
+template <int CHANNELS>
 struct MixerWidget : ModuleWidget {
-    MixerWidget(Mixer *module) : ModuleWidget(module) {
-	setPanel(SVG::load(assetPlugin(plugin, "res/Mixer.svg")));
+    static const int INPUT_BLOCKS = (CHANNELS + MIXER_INPUT_ROWS - 1) / MIXER_INPUT_ROWS;
+
+    Menu *createContextMenu() override;
+
+    MixerWidget(Mixer<CHANNELS> *module) : ModuleWidget(module) {
+	typedef Mixer<CHANNELS> M;
+	float stripX = 100 + (INPUT_BLOCKS - 1) * 95;
+	//offset of the master section relative to the 6 channel panel
+	float masterOffset = stripX + CHANNELS * 48 - 388;
+
+	if(CHANNELS == 6) {
+	    setPanel(SVG::load(assetPlugin(plugin, "res/Mixer.svg")));
+	}
+	else {
+	    addMixerPanel(this, 450 + masterOffset);
+	    addMixerLabels<M>(this, stripX);
+	    addPanelLabel(this, Vec(37, 231), "AUX 1");
+	    addPanelLabel(this, Vec(37, 307), "AUX 2");
+	    for(int a=0;a<2;a++) {
+		addPanelLabel(this, Vec(68, 250 + a * 76), "OUT", NVG_ALIGN_LEFT | NVG_ALIGN_BASELINE);
+		addPanelLabel(this, Vec(68, 280 + a * 76), "IN", NVG_ALIGN_LEFT | NVG_ALIGN_BASELINE);
+	    }
+	    addPanelLabel(this, Vec(392 + masterOffset, 44), "L");
+	    addPanelLabel(this, Vec(422 + masterOffset, 44), "R");
+	    addPanelLabel(this, Vec(407 + masterOffset, 190), "HIGH");
+	    addPanelLabel(this, Vec(407 + masterOffset, 245), "MID");
+	    addPanelLabel(this, Vec(407 + masterOffset, 300), "LOW");
+	}
 
 	addChild(Widget::create<ScrewSilver>(Vec(RACK_GRID_WIDTH, 0)));
 	addChild(Widget::create<ScrewSilver>(Vec(box.size.x - 2 * RACK_GRID_WIDTH, 0)));
 	addChild(Widget::create<ScrewSilver>(Vec(RACK_GRID_WIDTH, RACK_GRID_HEIGHT - RACK_GRID_WIDTH)));
 	addChild(Widget::create<ScrewSilver>(Vec(box.size.x - 2 * RACK_GRID_WIDTH, RACK_GRID_HEIGHT - RACK_GRID_WIDTH)));
 
-	for(int i=0;i<NUM_CHANNELS;i++) {
-	    addParam(ParamWidget::create<BefacoWhiteKnob>(Vec(100 + i * 48, 10), module, Mixer::AUX1_PARAM + i, 0.0f, 1.0f, 0.0f));
-	    addParam(ParamWidget::create<BefacoWhiteKnob>(Vec(100 + i * 48, 57), module, Mixer::AUX2_PARAM + i, 0.0f, 1.0f, 0.0f));
-	    addParam(ParamWidget::create<BefacoWhiteKnob>(Vec(100 + i * 48, 104), module, Mixer::PAN_PARAM + i, -1.0f, 1.0f, 0.0f));
-	    addParam(ParamWidget::create<BefacoDarkKnob>(Vec(100 + i * 48, 151), module, Mixer::EQ_HIGH_PARAM + i, -15.0f, 15.0f, 0.0f));
-	    addParam(ParamWidget::create<BefacoDarkKnob>(Vec(100 + i * 48, 198), module, Mixer::EQ_MID_PARAM + i, -12.5f, 12.5f, 0.0f));
-	    addParam(ParamWidget::create<BefacoDarkKnob>(Vec(100 + i * 48, 245), module, Mixer::EQ_LOW_PARAM + i, -20.0f, 20.0f, 0.0f));
-
-	    addParam(ParamWidget::create<BefacoPush>(Vec(103 + i * 48, 290), module, Mixer::MUTE_PARAM + i, 0.0f, 1.0f, 0.0f));
-	    addChild(ModuleLightWidget::create<SmallLight<RedLight>>(Vec(99 + i * 48, 288), module, Mixer::MUTE_LIGHT + i));
-	    addParam(ParamWidget::create<BefacoRedKnob>(Vec(100 + i * 48, 330), module, Mixer::GAIN_PARAM + i, -60.0f, 0.0f, -6.0f));
-
-	    addInput(Port::create<PJ301MPort>(Vec(5, 25 + i * 30), Port::INPUT, module, Mixer::CH1_INPUT + i));
-	    addInput(Port::create<PJ301MPort>(Vec(35, 25 + i * 30), Port::INPUT, module, Mixer::CH1_GAIN_INPUT + i));
-	    addInput(Port::create<PJ301MPort>(Vec(65, 25 + i * 30), Port::INPUT, module, Mixer::CH1_PAN_INPUT + i));
-	}
+	addMixerChannels<M>(this, module, stripX);
 
-	addParam(ParamWidget::create<Davies1900hLargeRedKnob>(Vec(380, 310), module, Mixer::MASTER_GAIN_PARAM, -60.0f, 0.0f, -20.0f));
-	addParam(ParamWidget::create<Davies1900hWhiteKnob>(Vec(389, 143), module, Mixer::MASTER_EQ_HIGH_PARAM, -7.0f, 7.0f, 0.0f));
-	addParam(ParamWidget::create<Davies1900hWhiteKnob>(Vec(389, 198), module, Mixer::MASTER_EQ_MID_PARAM, -7.0f, 7.0f, 0.0f));
-	addParam(ParamWidget::create<Davies1900hWhiteKnob>(Vec(389, 253), module, Mixer::MASTER_EQ_LOW_PARAM, -10.0f, 10.0f, 0.0f));
+	addParam(ParamWidget::create<Davies1900hLargeRedKnob>(Vec(380 + masterOffset, 310), module, M::MASTER_GAIN_PARAM, -60.0f, 0.0f, -20.0f));
+	addParam(ParamWidget::create<Davies1900hWhiteKnob>(Vec(389 + masterOffset, 143), module, M::MASTER_EQ_HIGH_PARAM, -7.0f, 7.0f, 0.0f));
+	addParam(ParamWidget::create<Davies1900hWhiteKnob>(Vec(389 + masterOffset, 198), module, M::MASTER_EQ_MID_PARAM, -7.0f, 7.0f, 0.0f));
+	addParam(ParamWidget::create<Davies1900hWhiteKnob>(Vec(389 + masterOffset, 253), module, M::MASTER_EQ_LOW_PARAM, -10.0f, 10.0f, 0.0f));
 	//meter
 	for(int i=0;i<6;i++) {
-	    addChild(ModuleLightWidget::create<MediumLight<RedLight>>(Vec(395, 60 + i * 13), module, Mixer::METER_L_LIGHT + i));
-	    addChild(ModuleLightWidget::create<MediumLight<RedLight>>(Vec(410, 60 + i * 13), module, Mixer::METER_R_LIGHT + i));
+	    addChild(ModuleLightWidget::create<MediumLight<RedLight>>(Vec(395 + masterOffset, 60 + i * 13), module, M::METER_L_LIGHT + i));
+	    addChild(ModuleLightWidget::create<MediumLight<RedLight>>(Vec(410 + masterOffset, 60 + i * 13), module, M::METER_R_LIGHT + i));
 	}
 
-	addOutput(Port::create<PJ301MPort>(Vec(380, 10), Port::OUTPUT, module, Mixer::L_OUTPUT));
-	addOutput(Port::create<PJ301MPort>(Vec(410, 10), Port::OUTPUT, module, Mixer::R_OUTPUT));
+	addOutput(Port::create<PJ301MPort>(Vec(380 + masterOffset, 10), Port::OUTPUT, module, M::L_OUTPUT));
+	addOutput(Port::create<PJ301MPort>(Vec(410 + masterOffset, 10), Port::OUTPUT, module, M::R_OUTPUT));
+
+	addOutput(Port::create<PJ301MPort>(Vec(10, 234), Port::OUTPUT, module, M::AUX1_L_OUTPUT));
+	addOutput(Port::create<PJ301MPort>(Vec(40, 234), Port::OUTPUT, module, M::AUX1_R_OUTPUT));
+	addInput(Port::create<PJ301MPort>(Vec(10, 264), Port::INPUT, module, M::AUX1_L_INPUT));
+	addInput(Port::create<PJ301MPort>(Vec(40, 264), Port::INPUT, module, M::AUX1_R_INPUT));
+
+	addOutput(Port::create<PJ301MPort>(Vec(10, 310), Port::OUTPUT, module, M::AUX2_L_OUTPUT));
+	addOutput(Port::create<PJ301MPort>(Vec(40, 310), Port::OUTPUT, module, M::AUX2_R_OUTPUT));
+	addInput(Port::create<PJ301MPort>(Vec(10, 340), Port::INPUT, module, M::AUX2_L_INPUT));
+	addInput(Port::create<PJ301MPort>(Vec(40, 340), Port::INPUT, module, M::AUX2_R_INPUT));
+    }
+};
+
+template <int CHANNELS>
+struct MixerExpanderWidget : ModuleWidget {
+    static const int INPUT_BLOCKS = (CHANNELS + MIXER_INPUT_ROWS - 1) / MIXER_INPUT_ROWS;
 
-	addOutput(Port::create<PJ301MPort>(Vec(10, 234), Port::OUTPUT, module, Mixer::AUX1_L_OUTPUT));
-	addOutput(Port::create<PJ301MPort>(Vec(40, 234), Port::OUTPUT, module, Mixer::AUX1_R_OUTPUT));
-	addInput(Port::create<PJ301MPort>(Vec(10, 264), Port::INPUT, module, Mixer::AUX1_L_INPUT));
-	addInput(Port::create<PJ301MPort>(Vec(40, 264), Port::INPUT, module, Mixer::AUX1_R_INPUT));
+    MixerExpanderWidget(MixerExpander<CHANNELS> *module) : ModuleWidget(module) {
+	typedef MixerExpander<CHANNELS> M;
+	float stripX = 100 + (INPUT_BLOCKS - 1) * 95;
+	addMixerPanel(this, stripX + CHANNELS * 48 + 15);
 
-	addOutput(Port::create<PJ301MPort>(Vec(10, 310), Port::OUTPUT, module, Mixer::AUX2_L_OUTPUT));
-	addOutput(Port::create<PJ301MPort>(Vec(40, 310), Port::OUTPUT, module, Mixer::AUX2_R_OUTPUT));
-	addInput(Port::create<PJ301MPort>(Vec(10, 340), Port::INPUT, module, Mixer::AUX2_L_INPUT));
-	addInput(Port::create<PJ301MPort>(Vec(40, 340), Port::INPUT, module, Mixer::AUX2_R_INPUT));
+	addChild(Widget::create<ScrewSilver>(Vec(RACK_GRID_WIDTH, 0)));
+	addChild(Widget::create<ScrewSilver>(Vec(box.size.x - 2 * RACK_GRID_WIDTH, 0)));
+	addChild(Widget::create<ScrewSilver>(Vec(RACK_GRID_WIDTH, RACK_GRID_HEIGHT - RACK_GRID_WIDTH)));
+	addChild(Widget::create<ScrewSilver>(Vec(box.size.x - 2 * RACK_GRID_WIDTH, RACK_GRID_HEIGHT - RACK_GRID_WIDTH)));
+
+	addMixerChannels<M>(this, module, stripX);
+	addMixerLabels<M>(this, stripX);
+	addChild(ModuleLightWidget::create<MediumLight<GreenLight>>(Vec(35, 250), module, M::LINK_LIGHT));
+	addPanelLabel(this, Vec(39, 272), "LINK");
+    }
 
+    //Rack removes the module from the engine and deletes it after this, unlink it first
+    ~MixerExpanderWidget() {
+	MixerModule *m = dynamic_cast<MixerModule*>(module);
+	if(m)
+	    MixerModule::unlink(m);
+    }
+
+    //link to the Mixer (or expander) on the left
+    void step() override {
+	MixerModule *m = dynamic_cast<MixerModule*>(module);
+	if(m) {
+	    MixerModule *left = findLeftMixer(this);
+	    MixerModule::unlink(m, left);
+	    if(left && left->right.load() != m)
+		left->right.store(m, std::memory_order_release);
+	}
+	ModuleWidget::step();
+    }
+};
+
+/* Toggles one of the Mixer's boolean options */
+struct MixerToggleItem : MenuItem {
+    bool *value;
+    void onAction(EventAction &e) override {
+	*value ^= true;
+    }
+    void step() override {
+	rightText = (*value) ? "✔" : "";
+	MenuItem::step();
     }
 };
 
-Model *modelMixer = Model::create<Mixer, MixerWidget>("Aepelzens Modules", "Mixer", "HexMix", MIXER_TAG);
+template <int CHANNELS>
+Menu *MixerWidget<CHANNELS>::createContextMenu() {
+    Menu *menu = ModuleWidget::createContextMenu();
+
+    Mixer<CHANNELS> *mixer = dynamic_cast<Mixer<CHANNELS>*>(module);
+    assert(mixer);
+
+    menu->addChild(construct<MenuEntry>());
+    menu->addChild(construct<MenuLabel>(&MenuLabel::text, "Meter"));
+    menu->addChild(construct<MixerToggleItem>(&MixerToggleItem::text, "Peak Hold", &MixerToggleItem::value, &mixer->peakHold));
+    menu->addChild(construct<MixerToggleItem>(&MixerToggleItem::text, "True Peak", &MixerToggleItem::value, &mixer->truePeak));
+    menu->addChild(construct<MixerToggleItem>(&MixerToggleItem::text, "RMS", &MixerToggleItem::value, &mixer->rmsMeter));
+
+    return menu;
+}
+
+Model *modelMixer = Model::create<Mixer<6>, MixerWidget<6>>("Aepelzens Modules", "Mixer", "HexMix", MIXER_TAG);
+Model *modelMixer4 = Model::create<Mixer<4>, MixerWidget<4>>("Aepelzens Modules", "Mixer4", "QuadMix", MIXER_TAG);
+Model *modelMixer8 = Model::create<Mixer<8>, MixerWidget<8>>("Aepelzens Modules", "Mixer8", "OctoMix", MIXER_TAG);
+Model *modelMixer12 = Model::create<Mixer<12>, MixerWidget<12>>("Aepelzens Modules", "Mixer12", "Mix12", MIXER_TAG);
+Model *modelMixer16 = Model::create<Mixer<16>, MixerWidget<16>>("Aepelzens Modules", "Mixer16", "Mix16", MIXER_TAG);
+Model *modelMixerExpander = Model::create<MixerExpander<6>, MixerExpanderWidget<6>>("Aepelzens Modules", "MixerExpander", "HexMix Expander", MIXER_TAG);
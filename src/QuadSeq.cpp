@@ -1,5 +1,6 @@
 #include "aepelzen.hpp"
 #include "dsp/digital.hpp"
+#include "AeStepper.hpp"
 
 #define NUM_CHANNELS 4
 
@@ -37,14 +38,6 @@ struct QuadSeq : Module {
     NUM_LIGHTS = CHANNEL_LIGHTS + 8 * NUM_CHANNELS
   };
 
-  enum PlaybackModes {
-    MODE_FORWARD,
-    MODE_BACKWARD,
-    MODE_ALTERNATING,
-    MODE_RANDOM_NEIGHBOUR,
-    MODE_RANDOM
-  };
-
   bool running = true;
   bool manualStepSelect = false;
   SchmittTrigger clockTrigger; // for external clock
@@ -61,10 +54,8 @@ struct QuadSeq : Module {
   float resetLight = 0.0;
   float stepLights[NUM_CHANNELS][8] = {};
 
-  int channel_index[NUM_CHANNELS] = {};
+  AeStepper<> stepper[NUM_CHANNELS];
   float rowValue[NUM_CHANNELS] = {};
-  //playback direction: true for forward, false for backward
-  bool direction[NUM_CHANNELS] = {};
 
   QuadSeq() : Module(NUM_PARAMS, NUM_INPUTS, NUM_OUTPUTS, NUM_LIGHTS) {
     reset();
@@ -88,8 +79,7 @@ struct QuadSeq : Module {
 
   void reset() override {
     for(int i=0;i<NUM_CHANNELS;i++) {
-      direction[i] = true;
-      channel_index[i] = 0;
+      stepper[i].reset();
     }
   }
 };
@@ -132,7 +122,7 @@ void QuadSeq::step() {
     nextStep = true;
     resetLight = 1.0;
     for (int i=0;i<NUM_CHANNELS;i++) {
-      channel_index[i] = -1;
+      stepper[i].index = -1;
     }
   }
 
@@ -140,7 +130,7 @@ void QuadSeq::step() {
   for(int i=0;i<8;i++) {
       if(stepSelectTrigger[i].process(params[STEP_SELECT_PARAM + i].value)) {
 	  for(int y=0;y<NUM_CHANNELS;y++) {
-	      channel_index[y] = i;
+	      stepper[y].index = i;
 	  }
 	  manualStepSelect = true;
 	  break;
@@ -168,10 +158,6 @@ void QuadSeq::step() {
       float prob = params[CHANNEL_PROB_PARAM + y].value * 2.0f;
       int stepsize = 1;
 
-      if (mode == MODE_RANDOM_NEIGHBOUR) {
-	  mode = (randomUniform() > 0.5) ? MODE_FORWARD : MODE_BACKWARD;
-      }
-
       //values smaller than zero repeat a step, greater than zero skip
       if(prob < 1.0f) {
 	  stepsize = (randomUniform() > prob) ? 0 : 1;
@@ -180,53 +166,19 @@ void QuadSeq::step() {
 	  stepsize = (randomUniform() < (prob - 1.0f)) ? 2 : 1;
       }
 
-      if(numSteps > 1) {
-	  switch(mode) {
-	  case MODE_FORWARD:
-	      channel_index[y] += stepsize;
-	      channel_index[y] %= numSteps;
-	      break;
-	  case MODE_BACKWARD:
-	      channel_index[y] -= stepsize;
-	      channel_index[y] = modN(channel_index[y], numSteps);
-	      break;
-	  case MODE_ALTERNATING:
-	      if (direction[y]) {
-		  channel_index[y] += stepsize;
-		  if (channel_index[y] >= numSteps - 1) {
-		      //the second part is zero when we end right at the last step or 1 when we moved past it because of skipping
-		      //use that to correct for position for skipping
-		      channel_index[y] = numSteps - 1 - (channel_index[y] % (numSteps - 1));
-		      direction[y] = !direction[y];
-		  }
-	      }
-	      else {
-		  channel_index[y] -= stepsize;
-		  if (channel_index[y] <= 0) {
-		      channel_index[y] = -1 * channel_index[y];
-		      direction[y] = !direction[y];
-		  }
-	      }
-	      break;
-	  case MODE_RANDOM:
-	      channel_index[y] = rand() % numSteps;
-	      break;
-	  }
-      }
-      else
-	  channel_index[y] = 0;
+      stepper[y].advance(mode, numSteps, stepsize);
 
-      stepLights[y][channel_index[y]] = 1.0;
+      stepLights[y][stepper[y].index] = 1.0;
     }
 
     // Outputs
-    rowValue[y] = (params[ROW1_PARAM + channel_index[y] + y * 8].value) * params[CHANNEL_RANGE_PARAM + y].value;
+    rowValue[y] = (params[ROW1_PARAM + stepper[y].index + y * 8].value) * params[CHANNEL_RANGE_PARAM + y].value;
     outputs[ROW1_OUTPUT + y].value = (running || manualStepSelect) ? outputs[ROW1_OUTPUT + y].value = rowValue[y] : 0.0f;
 
     // steplights
     for (int i = 0; i < 8; i++) {
       //stepLights[y][i] -= stepLights[y][i] / lightLambda / engineGetSampleRate();
-      stepLights[y][i] = (i == channel_index[y]) ? 1.0 : 0.0;
+      stepLights[y][i] = (i == stepper[y].index) ? 1.0 : 0.0;
       lights[CHANNEL_LIGHTS + i + 8*y].value = stepLights[y][i];
     }
   }
@@ -87,6 +87,9 @@ struct AeSampler : Module {
     float gainParam = 0.0f;
 
     AeFilterFrame<2> filter;
+    //state variable filter, safe for audio-rate cutoff modulation
+    AeSVFFrame<2> svf;
+    bool svfMode = false;
 
     const float LP_MAX_FREQ = 16000.0f;
     const float LP_MIN_FREQ = 30.0f;
@@ -181,6 +184,7 @@ struct AeSampler : Module {
 	    }
 	}
 	json_object_set_new(rootJ, "files", samplesJ);
+	json_object_set_new(rootJ, "svfMode", json_boolean(svfMode));
 	return rootJ;
     };
 
@@ -201,6 +205,10 @@ struct AeSampler : Module {
 		if(gainJ) samples[i].gain = json_number_value(gainJ);
 	    }
 	}
+	json_t *svfModeJ = json_object_get(rootJ, "svfMode");
+	if(svfModeJ) {
+	    svfMode = json_boolean_value(svfModeJ);
+	}
     };
 };
 
@@ -422,16 +430,24 @@ void AeSampler::step() {
 
     if(filterParam != 1.0f) {
 	float freq;
+	AeFilterType type;
 	if(filterParam > 1.0f) {
 	    freq = HP_MIN_FREQ * powf(HP_MAX_FREQ / HP_MIN_FREQ, filterParam - 1.0f);
-	    filter.setCutoff(freq, q, AeFilterType::AeHIGHPASS);
+	    type = AeFilterType::AeHIGHPASS;
 	}
 	else {
 	    freq = LP_MIN_FREQ * powf(LP_MAX_FREQ / LP_MIN_FREQ, filterParam);
-	    filter.setCutoff(freq, q, AeFilterType::AeLOWPASS);
+	    type = AeFilterType::AeLOWPASS;
 	}
 	//apply filter
-	out = filter.process(out);
+	if(svfMode) {
+	    svf.setCutoff(freq, q, type);
+	    out = svf.process(out);
+	}
+	else {
+	    filter.setCutoff(freq, q, type);
+	    out = filter.process(out);
+	}
     }
 
     outputs[L_OUTPUT].value = out.samples[0] * 5.0f * gain * activeSample->gain;
@@ -573,6 +589,8 @@ struct AeLoadButton : LEDButton {
 };
 
 struct AeSamplerWidget : ModuleWidget {
+    Menu *createContextMenu() override;
+
     AeSamplerWidget(AeSampler *module) : ModuleWidget(module) {
 	setPanel(SVG::load(assetPlugin(plugin, "res/Sampler.svg")));
 
@@ -633,4 +651,32 @@ struct AeSamplerWidget : ModuleWidget {
     }
 };
 
+struct AeSamplerSVFMenuItem : MenuItem {
+    AeSampler *module;
+    void onAction(EventAction &e) override {
+	module->svfMode ^= true;
+	//don't start from whatever state the filter had when it was last used
+	if(module->svfMode)
+	    module->svf.init();
+	else
+	    module->filter.init();
+    }
+    void step() override {
+	rightText = (module->svfMode) ? "✔" : "";
+	MenuItem::step();
+    }
+};
+
+Menu *AeSamplerWidget::createContextMenu() {
+    Menu *menu = ModuleWidget::createContextMenu();
+
+    AeSampler *sampler = dynamic_cast<AeSampler*>(module);
+    assert(sampler);
+
+    menu->addChild(construct<MenuEntry>());
+    menu->addChild(construct<AeSamplerSVFMenuItem>(&AeSamplerSVFMenuItem::text, "State Variable Filter", &AeSamplerSVFMenuItem::module, sampler));
+
+    return menu;
+}
+
 Model *modelAeSampler = Model::create<AeSampler, AeSamplerWidget>("Aepelzens Modules", "Sampler", "DrumSampler", SAMPLER_TAG);
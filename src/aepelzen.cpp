@@ -13,9 +13,15 @@ void init(rack::Plugin *p) {
 	p->addModel(modelDice);
 	p->addModel(modelBurst);
 	p->addModel(modelFolder);
+	p->addModel(modelPolyFolder);
 	p->addModel(modelWalker);
 	p->addModel(modelErwin);
 	p->addModel(modelWerner);
 	p->addModel(modelAeSampler);
 	p->addModel(modelMixer);
+	p->addModel(modelMixer4);
+	p->addModel(modelMixer8);
+	p->addModel(modelMixer12);
+	p->addModel(modelMixer16);
+	p->addModel(modelMixerExpander);
 }
@@ -1,4 +1,5 @@
 #include "rack.hpp"
+#include <atomic>
 
 using namespace rack;
 
@@ -15,6 +16,97 @@ inline int ceilN(float x) {
     return (x < 0) ? (int)floor(x) : (int)ceil(x);
 }
 
+/* malloc with the result aligned to `alignment` bytes (a power of two), for
+   modules with cache line aligned members. The original pointer is stored
+   right before the returned block */
+inline void *alignedMalloc(size_t size, size_t alignment) {
+    void *p = malloc(size + alignment - 1 + sizeof(void*));
+    if(!p)
+	throw std::bad_alloc();
+    uintptr_t aligned = ((uintptr_t)p + sizeof(void*) + alignment - 1) & ~(uintptr_t)(alignment - 1);
+    ((void**)aligned)[-1] = p;
+    return (void*)aligned;
+}
+
+inline void alignedFree(void *p) {
+    if(p)
+	free(((void**)p)[-1]);
+}
+
+/* Lock-free queue for one producer thread and one consumer thread. Modules
+   use it to hand edits from the GUI thread to step(), which applies them
+   between two samples. SIZE must be a power of two */
+template<typename T, unsigned int SIZE>
+struct SpscQueue {
+    //read positions (written by the consumer) and write positions (producer)
+    std::atomic<unsigned int> head;
+    std::atomic<unsigned int> tail;
+    T items[SIZE];
+
+    SpscQueue() : head(0), tail(0) {}
+
+    //false if the queue is full
+    bool push(const T &item) {
+	unsigned int t = tail.load(std::memory_order_relaxed);
+	if(t - head.load(std::memory_order_acquire) >= SIZE)
+	    return false;
+	items[t % SIZE] = item;
+	tail.store(t + 1, std::memory_order_release);
+	return true;
+    }
+
+    /* pushes n items at once, the consumer sees all of them or none. False
+       (and nothing pushed) if they don't fit */
+    bool push(const T *batch, unsigned int n) {
+	unsigned int t = tail.load(std::memory_order_relaxed);
+	if(t - head.load(std::memory_order_acquire) + n > SIZE)
+	    return false;
+	for(unsigned int i=0;i<n;i++) {
+	    items[(t + i) % SIZE] = batch[i];
+	}
+	tail.store(t + n, std::memory_order_release);
+	return true;
+    }
+
+    //false if the queue is empty
+    bool pop(T &item) {
+	unsigned int h = head.load(std::memory_order_relaxed);
+	if(h == tail.load(std::memory_order_acquire))
+	    return false;
+	item = items[h % SIZE];
+	head.store(h + 1, std::memory_order_release);
+	return true;
+    }
+};
+
+/* dB to linear gain from a lookup table (-60 to +12 dB in 0.05 dB steps,
+   linear interpolation in between). Values outside the range are clamped */
+struct DbTable {
+    static const int SIZE = 1440;
+    const float MIN_DB = -60.0f;
+    const float MAX_DB = 12.0f;
+    float table[SIZE + 2];
+
+    DbTable() {
+	for(int i=0;i<=SIZE;i++) {
+	    table[i] = pow(10, (MIN_DB + (MAX_DB - MIN_DB) * i / SIZE) / 20.0f);
+	}
+	table[SIZE + 1] = table[SIZE];
+    }
+
+    float lookup(float db) {
+	float pos = (clamp(db, MIN_DB, MAX_DB) - MIN_DB) * SIZE / (MAX_DB - MIN_DB);
+	int index = (int)pos;
+	float frac = pos - index;
+	return table[index] + frac * (table[index + 1] - table[index]);
+    }
+};
+
+inline float dbToGain(float db) {
+    static DbTable dbTable;
+    return dbTable.lookup(db);
+}
+
 struct Knob29 : RoundKnob {
 	Knob29() {
 		setSVG(SVG::load(assetPlugin(plugin, "res/knob_29px.svg")));
@@ -61,6 +153,33 @@ struct BefacoDarkKnob : SVGKnob {
 	}
 };
 
+/* Text for the generated panels of the module variants without artwork */
+struct AePanelLabel : TransparentWidget {
+    std::shared_ptr<Font> font;
+    std::string text;
+    int align = NVG_ALIGN_CENTER | NVG_ALIGN_BASELINE;
+
+    AePanelLabel() {
+	font = Font::load(assetGlobal("res/fonts/DejaVuSans.ttf"));
+    }
+
+    void draw(NVGcontext *vg) override {
+	nvgFontSize(vg, 8);
+	nvgFontFaceId(vg, font->handle);
+	nvgTextAlign(vg, align);
+	nvgFillColor(vg, nvgRGB(0xdd, 0xdd, 0xdd));
+	nvgText(vg, 0, 0, text.c_str(), NULL);
+    }
+};
+
+//pos is the baseline, centered unless align says otherwise
+inline void addPanelLabel(ModuleWidget *w, Vec pos, std::string text, int align = NVG_ALIGN_CENTER | NVG_ALIGN_BASELINE) {
+    AePanelLabel *label = Widget::create<AePanelLabel>(pos);
+    label->text = text;
+    label->align = align;
+    w->addChild(label);
+}
+
 template <typename BASE>
 struct BigLight : BASE {
 	BigLight() {
@@ -73,8 +192,14 @@ extern Model *modelGateSeq;
 extern Model *modelDice;
 extern Model *modelBurst;
 extern Model *modelFolder;
+extern Model *modelPolyFolder;
 extern Model *modelWalker;
 extern Model *modelErwin;
 extern Model *modelWerner;
 extern Model *modelAeSampler;
 extern Model *modelMixer;
+extern Model *modelMixer4;
+extern Model *modelMixer8;
+extern Model *modelMixer12;
+extern Model *modelMixer16;
+extern Model *modelMixerExpander;
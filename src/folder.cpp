@@ -1,9 +1,39 @@
 #include "aepelzen.hpp"
 #include "dsp/digital.hpp"
-#include "dsp/samplerate.hpp"
+#include "AeFold.hpp"
+#include "AeOversampler.hpp"
+#include <chrono>
 
 #define BUF_LEN 32
-#define FOLDER_SAMPLE_RATE 192000
+//oversampling factor of PolyFolder (2, 4 or 8)
+#define FOLDER_OVERSAMPLING 4
+//number of folds of the single pass algorithm (practically unlimited)
+#define FOLD_UNLIMITED 1e6f
+
+//quality/CPU tiers of Folder, cheapest first
+enum FolderQuality {
+    QUALITY_ADAA,
+    QUALITY_ADAA_2X,
+    QUALITY_2X,
+    QUALITY_4X,
+    QUALITY_8X,
+    NUM_QUALITIES
+};
+
+struct FolderQualityTier {
+    const char *name;
+    int factor;
+    //antiderivative anti-aliasing instead of the plain fold
+    bool adaa;
+};
+
+static const FolderQualityTier folderQualityTiers[NUM_QUALITIES] = {
+    {"ADAA", 1, true},
+    {"ADAA + 2x Oversampling", 2, true},
+    {"2x Oversampling", 2, false},
+    {"4x Oversampling", 4, false},
+    {"8x Oversampling", 8, false}
+};
 
 struct Folder : Module {
     enum ParamIds {
@@ -31,14 +61,10 @@ struct Folder : Module {
 
     void step() override;
 
-    Folder() : Module(NUM_PARAMS, NUM_INPUTS, NUM_OUTPUTS, NUM_LIGHTS) {
-	convUp.setRates(engineGetSampleRate(),FOLDER_SAMPLE_RATE);
-	convDown.setRates(FOLDER_SAMPLE_RATE, engineGetSampleRate());
-    }
+    Folder() : Module(NUM_PARAMS, NUM_INPUTS, NUM_OUTPUTS, NUM_LIGHTS), oversampler(folderQualityTiers[QUALITY_4X].factor) {}
 
     void onSampleRateChange() override {
-	convUp.setRates(engineGetSampleRate(),FOLDER_SAMPLE_RATE);
-	convDown.setRates(FOLDER_SAMPLE_RATE, engineGetSampleRate());
+	oversampler.reset();
     }
 
     void randomize() override  {}
@@ -46,6 +72,8 @@ struct Folder : Module {
     json_t *toJson() override {
 	json_t *rootJ = json_object();
 	json_object_set_new(rootJ, "alternativeMode", json_boolean(alternativeMode));
+	json_object_set_new(rootJ, "lowLatency", json_boolean(lowLatency));
+	json_object_set_new(rootJ, "quality", json_integer(quality));
 	return rootJ;
     }
 
@@ -54,78 +82,150 @@ struct Folder : Module {
 	if(modeJ) {
 	    alternativeMode = json_boolean_value(modeJ);
 	}
+	json_t *lowLatencyJ = json_object_get(rootJ, "lowLatency");
+	if(lowLatencyJ) {
+	    lowLatency = json_boolean_value(lowLatencyJ);
+	}
+	json_t *qualityJ = json_object_get(rootJ, "quality");
+	if(qualityJ) {
+	    quality = clamp((int)json_integer_value(qualityJ), 0, NUM_QUALITIES - 1);
+	}
+	else if(json_is_true(json_object_get(rootJ, "adaa"))) {
+	    //older patches had a separate ADAA switch (with 2x oversampling)
+	    quality = QUALITY_ADAA_2X;
+	}
     }
 
     float in, out, gain, sym;
     float threshold = 1.0;
 
     bool alternativeMode = false;
-
-    SampleRateConverter<1> convUp;
-    SampleRateConverter<1> convDown;
+    //run the oversampler one sample at a time instead of in blocks of BUF_LEN
+    bool lowLatency = false;
+    int quality = QUALITY_4X;
+    //measured processing time per frame in seconds for each tier (0 = not measured yet)
+    float cpuTime[NUM_QUALITIES] = {};
+    //antiderivative anti-aliasing, set by the quality tier
+    bool adaaMode = false;
+    float adaaLastIn = 0.0f;
+    double adaaLastIntegral = 0.0;
+
+    //integer ratio, so the filters don't depend on the engine sample rate
+    AeOversampler<1> oversampler;
 
     int frame = 0;
-    //smallest supported sampleRate in Rack is 44100 (upsample ratio = 4.35)
     Frame<1> in_buffer[BUF_LEN] = {};
-    Frame<1> out_buffer[5*BUF_LEN] = {};
+    Frame<1> out_buffer[AeOversampler<1>::MAX_FACTOR*BUF_LEN] = {};
     Frame<1> folded_buffer[BUF_LEN] = {};
 
-    float fold(float in, float threshold) {
+    static double logCosh(double x) {
+	x = fabs(x);
+	return x + log1p(exp(-2.0 * x)) - M_LN2;
+    }
+
+    /* Antiderivative of tanh(fold(x)). Each piece contributes s * logcosh(fold(x))
+       (s = +-1 is the slope), the constant keeps it continuous at the folds */
+    static double foldTanhIntegral(float x, float t, float maxPiece) {
+	double s = aeFoldSlope(aeFoldPiece(x, t, maxPiece));
+	return s * logCosh(aeFoldLinear(x, t, maxPiece)) + (1.0 - s) * logCosh(t);
+    }
+
+    //first order ADAA of tanh(fold(x))
+    float shapeADAA(float x, float maxPiece) {
+	double integral = foldTanhIntegral(x, threshold, maxPiece);
+	float dx = x - adaaLastIn;
 	float out;
-	if (in>threshold || in<-threshold) {
-	    out = clamp(fabs(fabs(fmod(in - threshold, threshold*4)) - threshold*2) - threshold, -5.0f,5.0f);
+	if(fabsf(dx) > 1e-4f) {
+	    out = (integral - adaaLastIntegral) / dx;
 	}
 	else {
-	    out = in;
+	    //ill conditioned, use the midpoint instead
+	    out = tanh(aeFoldLinear(0.5f * (x + adaaLastIn), threshold, maxPiece));
 	}
+	adaaLastIn = x;
+	adaaLastIntegral = integral;
 	return out;
     }
 
-    float fold3(float in, float t) {
-	float out = 0;
-	if(in>t) {
-	    out = t - (in - t);
-	}
-	else if (in < -t) {
-	    out = -t + (-t - in);
-	}
-	else {
-	    out = in;
-	}
-	return out;
+    void shape(Frame<1> *buffer, int len);
+
+    //latency of a quality tier in samples
+    float getLatency(int q) {
+	const FolderQualityTier &tier = folderQualityTiers[q];
+	float latency = oversampler.getLatency(tier.factor);
+	if(tier.adaa)
+	    //first order ADAA delays by half a sample of the oversampled rate
+	    latency += 0.5f / tier.factor;
+	if(!lowLatency)
+	    latency += BUF_LEN;
+	return latency;
     }
 
+    void measureCpuTime(std::chrono::high_resolution_clock::time_point start, int frames) {
+	std::chrono::duration<float> elapsed = std::chrono::high_resolution_clock::now() - start;
+	float t = elapsed.count() / frames;
+	float &average = cpuTime[quality];
+	average = (average == 0.0f) ? t : average + 0.05f * (t - average);
+    }
 };
 
+/* fold and saturate len oversampled frames in place */
+void Folder::shape(Frame<1> *buffer, int len) {
+    //the switch sets 1 to 3 stages, the fold runs twice per stage
+    float maxPiece = alternativeMode ? FOLD_UNLIMITED : (int)(params[STAGE_PARAM].value)*2;
+
+    if(adaaMode) {
+	for(int i=0;i<len;i++) {
+	    buffer[i].samples[0] = shapeADAA(buffer[i].samples[0], maxPiece);
+	}
+	return;
+    }
+
+    aeFoldBlock(&buffer[0].samples[0], len, threshold, maxPiece);
+}
+
 void Folder::step() {
     gain = clamp(params[GAIN_PARAM].value + (inputs[GAIN_INPUT].value * params[GAIN_ATT_PARAM].value), 0.0f,14.0f);
     sym = clamp(params[SYM_PARAM].value + inputs[SYM_INPUT].value/5.0 * params[SYM_ATT_PARAM].value, -1.0f, 1.0f);
     in = (inputs[GATE_INPUT].value/5.0 + sym) * gain;
 
+    const FolderQualityTier &tier = folderQualityTiers[quality];
+    adaaMode = tier.adaa;
+    if(oversampler.factor != tier.factor)
+	oversampler.setFactor(tier.factor);
+
+    if(lowLatency) {
+	//latency is only the filter delay and the load is the same in every frame
+	//(the CPU time is measured every BUF_LEN frames)
+	bool measure = (++frame >= BUF_LEN);
+	std::chrono::high_resolution_clock::time_point start;
+	if(measure) {
+	    frame = 0;
+	    start = std::chrono::high_resolution_clock::now();
+	}
+	Frame<1> inFrame = {{in}};
+	Frame<1> outFrame;
+	oversampler.upsample(&inFrame, 1, out_buffer);
+	shape(out_buffer, oversampler.factor);
+	oversampler.downsample(out_buffer, 1, &outFrame);
+	outputs[GATE_OUTPUT].value = outFrame.samples[0] * 5.0;
+	if(measure)
+	    measureCpuTime(start, 1);
+	return;
+    }
+
     if(++frame >= BUF_LEN) {
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
 	//upsampling
-	int outLen = 5 *BUF_LEN;
-	int inLen = BUF_LEN;
-	convUp.process(in_buffer, &inLen, out_buffer, &outLen);
+	oversampler.upsample(in_buffer, BUF_LEN, out_buffer);
 
 	//fold
-	for(int i=0;i<outLen;i++) {
-	    if(!alternativeMode) {
-		int stages = (int)(params[STAGE_PARAM].value)*2;
-		for (int y=0;y<stages;y++) {
-		    out_buffer[i].samples[0] = fold3(out_buffer[i].samples[0], threshold);
-		}
-	    }
-	    else {
-		out_buffer[i].samples[0] = fold(out_buffer[i].samples[0], threshold);
-	    }
-	    out_buffer[i].samples[0] = tanh(out_buffer[i].samples[0]);
-	}
+	shape(out_buffer, oversampler.factor * BUF_LEN);
 
 	//downSampling
-	int foldedLen = BUF_LEN;
-	convDown.process(out_buffer, &outLen, folded_buffer, &foldedLen);
+	oversampler.downsample(out_buffer, BUF_LEN, folded_buffer);
 	frame = 0;
+	measureCpuTime(start, BUF_LEN);
     }
 
     in_buffer[frame].samples[0] = in;
@@ -170,6 +270,29 @@ struct FolderMenuItem : MenuItem {
     }
 };
 
+struct FolderQualityItem : MenuItem {
+    Folder *module;
+    int quality;
+    void onAction(EventAction &e) override {
+	module->quality = quality;
+    }
+    void step() override {
+	rightText = (module->quality == quality) ? "✔" : "";
+	MenuItem::step();
+    }
+};
+
+struct FolderLowLatencyItem : MenuItem {
+    Folder *module;
+    void onAction(EventAction &e) override {
+	module->lowLatency ^= true;
+    }
+    void step() override {
+	rightText = (module->lowLatency) ? "✔" : "";
+	MenuItem::step();
+    }
+};
+
 Menu *FolderWidget::createContextMenu() {
     Menu *menu = ModuleWidget::createContextMenu();
 
@@ -178,8 +301,189 @@ Menu *FolderWidget::createContextMenu() {
 
     menu->addChild(construct<MenuEntry>());
     menu->addChild(construct<FolderMenuItem>(&FolderMenuItem::text, "Alternative Folding Algorithm", &FolderMenuItem::module, folder));
+    menu->addChild(construct<FolderLowLatencyItem>(&FolderLowLatencyItem::text, "Low Latency", &FolderLowLatencyItem::module, folder));
+
+    //latency and the measured CPU time (if the tier was used) of every tier
+    menu->addChild(construct<MenuEntry>());
+    menu->addChild(construct<MenuLabel>(&MenuLabel::text, "Quality"));
+    for(int q=0;q<NUM_QUALITIES;q++) {
+	std::string text = stringf("%s (%.1f samples", folderQualityTiers[q].name, folder->getLatency(q));
+	if(folder->cpuTime[q] > 0.0f)
+	    text += stringf(", %.2f us per frame", folder->cpuTime[q] * 1e6f);
+	text += ")";
+	menu->addChild(construct<FolderQualityItem>(&FolderQualityItem::text, text, &FolderQualityItem::module, folder, &FolderQualityItem::quality, q));
+    }
 
     return menu;
 }
 
 Model *modelFolder = Model::create<Folder, FolderWidget>("Aepelzens Modules", "folder", "Manifold", WAVESHAPER_TAG);
+
+
+/* Folder with VOICES independent voices. The knobs are shared, gain and
+   symmetry have a CV input per voice. All voices run through one
+   oversampler with one SIMD lane per voice (streaming, like the low
+   latency mode of Folder) */
+template <int VOICES>
+struct PolyFolder : Module {
+    enum ParamIds {
+	GAIN_PARAM,
+	GAIN_ATT_PARAM,
+	SYM_PARAM,
+	SYM_ATT_PARAM,
+	STAGE_PARAM,
+	NUM_PARAMS
+    };
+    enum InputIds {
+	IN_INPUT,
+	GAIN_INPUT = IN_INPUT + VOICES,
+	SYM_INPUT = GAIN_INPUT + VOICES,
+	NUM_INPUTS = SYM_INPUT + VOICES
+    };
+    enum OutputIds {
+	OUT_OUTPUT,
+	NUM_OUTPUTS = OUT_OUTPUT + VOICES
+    };
+    enum LightIds {
+	NUM_LIGHTS
+    };
+
+    PolyFolder() : Module(NUM_PARAMS, NUM_INPUTS, NUM_OUTPUTS, NUM_LIGHTS), oversampler(FOLDER_OVERSAMPLING) {}
+
+    void onSampleRateChange() override {
+	oversampler.reset();
+    }
+
+    json_t *toJson() override {
+	json_t *rootJ = json_object();
+	json_object_set_new(rootJ, "alternativeMode", json_boolean(alternativeMode));
+	return rootJ;
+    }
+
+    void fromJson(json_t *rootJ) override {
+	json_t *modeJ = json_object_get(rootJ, "alternativeMode");
+	if(modeJ) {
+	    alternativeMode = json_boolean_value(modeJ);
+	}
+    }
+
+    float threshold = 1.0f;
+    bool alternativeMode = false;
+    //false while no voice is patched, nothing is processed then
+    bool active = false;
+
+    AeOversampler<VOICES> oversampler;
+
+    void step() override;
+};
+
+template <int VOICES>
+void PolyFolder<VOICES>::step() {
+    float in[VOICES];
+    bool anyPatched = false;
+    for(int v=0;v<VOICES;v++) {
+	if(!inputs[IN_INPUT + v].active) {
+	    in[v] = 0.0f;
+	    continue;
+	}
+	float gain = clamp(params[GAIN_PARAM].value + inputs[GAIN_INPUT + v].value * params[GAIN_ATT_PARAM].value, 0.0f, 14.0f);
+	float sym = clamp(params[SYM_PARAM].value + inputs[SYM_INPUT + v].value / 5.0f * params[SYM_ATT_PARAM].value, -1.0f, 1.0f);
+	in[v] = (inputs[IN_INPUT + v].value / 5.0f + sym) * gain;
+	anyPatched = true;
+    }
+
+    if(!anyPatched) {
+	if(active) {
+	    oversampler.reset();
+	    for(int v=0;v<VOICES;v++) {
+		outputs[OUT_OUTPUT + v].value = 0.0f;
+	    }
+	    active = false;
+	}
+	return;
+    }
+    active = true;
+
+    float buffer[AeOversampler<VOICES>::MAX_FACTOR][VOICES];
+    oversampler.upsample(in, buffer);
+    float maxPiece = alternativeMode ? FOLD_UNLIMITED : (int)(params[STAGE_PARAM].value)*2;
+    aeFoldBlock(&buffer[0][0], oversampler.factor * VOICES, threshold, maxPiece);
+    float out[VOICES];
+    oversampler.downsample(buffer, out);
+
+    for(int v=0;v<VOICES;v++) {
+	outputs[OUT_OUTPUT + v].value = out[v] * 5.0f;
+    }
+}
+
+struct PolyFolderMenuItem : MenuItem {
+    bool *mode;
+    void onAction(EventAction &e) override {
+	*mode ^= true;
+    }
+    void step() override {
+	rightText = (*mode) ? "✔" : "";
+	MenuItem::step();
+    }
+};
+
+template <int VOICES>
+struct PolyFolderWidget : ModuleWidget {
+    //voices are arranged in blocks of 8 rows (input, gain cv, symmetry cv, output)
+    static const int ROWS = 8;
+
+    PolyFolderWidget(PolyFolder<VOICES> *module) : ModuleWidget(module) {
+	typedef PolyFolder<VOICES> M;
+	int blocks = (VOICES + ROWS - 1) / ROWS;
+	box.size = Vec(ceilf((blocks * 130 + 10) / RACK_GRID_WIDTH) * RACK_GRID_WIDTH, RACK_GRID_HEIGHT);
+
+	Panel *panel = new Panel();
+	panel->backgroundColor = nvgRGB(0x17, 0x17, 0x17);
+	panel->box.size = box.size;
+	addChild(panel);
+
+	addParam(ParamWidget::create<CKSSThreeH>(Vec(15, 50), module, M::STAGE_PARAM, 1, 3, 2));
+	addParam(ParamWidget::create<RoundBlackKnob>(Vec(70, 40), module, M::GAIN_PARAM, 0.0, 14.0, 1.0));
+	addParam(ParamWidget::create<Trimpot>(Vec(115, 46), module, M::GAIN_ATT_PARAM, -1.0, 1.0, 0));
+	addParam(ParamWidget::create<RoundBlackKnob>(Vec(150, 40), module, M::SYM_PARAM, -1.0, 1.0, 0.0));
+	addParam(ParamWidget::create<Trimpot>(Vec(195, 46), module, M::SYM_ATT_PARAM, -1.0, 1.0, 0.0));
+
+	addPanelLabel(this, Vec(34, 34), "STAGES");
+	addPanelLabel(this, Vec(89, 34), "GAIN");
+	addPanelLabel(this, Vec(124, 34), "ATT");
+	addPanelLabel(this, Vec(169, 34), "SYM");
+	addPanelLabel(this, Vec(204, 34), "ATT");
+
+	for(int b=0;b<blocks;b++) {
+	    float x = 10 + b * 130;
+	    addPanelLabel(this, Vec(x + 12, 94), "IN");
+	    addPanelLabel(this, Vec(x + 42, 94), "GAIN");
+	    addPanelLabel(this, Vec(x + 72, 94), "SYM");
+	    addPanelLabel(this, Vec(x + 102, 94), "OUT");
+	}
+
+	for(int v=0;v<VOICES;v++) {
+	    float x = 10 + (v / ROWS) * 130;
+	    float y = 100 + (v % ROWS) * 32;
+	    addPanelLabel(this, Vec(x + 122, y + 15), std::to_string(v + 1));
+	    addInput(Port::create<PJ301MPort>(Vec(x, y), Port::INPUT, module, M::IN_INPUT + v));
+	    addInput(Port::create<PJ301MPort>(Vec(x + 30, y), Port::INPUT, module, M::GAIN_INPUT + v));
+	    addInput(Port::create<PJ301MPort>(Vec(x + 60, y), Port::INPUT, module, M::SYM_INPUT + v));
+	    addOutput(Port::create<PJ301MPort>(Vec(x + 90, y), Port::OUTPUT, module, M::OUT_OUTPUT + v));
+	}
+    }
+
+    Menu *createContextMenu() override {
+	Menu *menu = ModuleWidget::createContextMenu();
+
+	PolyFolder<VOICES> *folder = dynamic_cast<PolyFolder<VOICES>*>(module);
+	assert(folder);
+
+	menu->addChild(construct<MenuEntry>());
+	menu->addChild(construct<PolyFolderMenuItem>(&PolyFolderMenuItem::text, "Alternative Folding Algorithm", &PolyFolderMenuItem::mode, &folder->alternativeMode));
+
+	return menu;
+    }
+};
+
+Model *modelPolyFolder = Model::create<PolyFolder<16>, PolyFolderWidget<16>>("Aepelzens Modules", "PolyFolder", "Manifold 16", WAVESHAPER_TAG);
@@ -0,0 +1,158 @@
+#include "AeStepper.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+
+static int failures = 0;
+
+#define CHECK(cond, ...) do { if(!(cond)) { printf("FAIL %s:%d: ", __FILE__, __LINE__); printf(__VA_ARGS__); printf("\n"); failures++; } } while(0)
+
+/* Reference for the deterministic modes: moves one step at a time and
+   bounces at the ends in alternating mode. index -1 is before the first step */
+struct RefStepper {
+    int index = -1;
+    bool forward = true;
+
+    void move(int mode, int numSteps) {
+	if(index < 0) {
+	    index = (mode == AE_BACKWARD) ? numSteps - 1 : 0;
+	    return;
+	}
+	switch(mode) {
+	case AE_FORWARD:
+	    index = (index + 1) % numSteps;
+	    break;
+	case AE_BACKWARD:
+	    index = (index + numSteps - 1) % numSteps;
+	    break;
+	case AE_ALTERNATING:
+	    if(forward && index == numSteps - 1)
+		forward = false;
+	    else if(!forward && index == 0)
+		forward = true;
+	    index += forward ? 1 : -1;
+	    break;
+	}
+    }
+
+    void advance(int mode, int numSteps, int stepsize) {
+	if(numSteps <= 1) {
+	    index = 0;
+	    return;
+	}
+	//the first advance after a reset always lands on a step, even when repeating
+	if(index < 0 && stepsize == 0)
+	    stepsize = 1;
+	for(int i=0;i<stepsize;i++)
+	    move(mode, numSteps);
+    }
+};
+
+static const int STEP_COUNTS[] = {1, 2, 5, 8};
+static const int RUN = 40;
+
+static void testDeterministic() {
+    const int modes[] = {AE_FORWARD, AE_BACKWARD, AE_ALTERNATING};
+    for(int mode : modes) {
+	for(int n : STEP_COUNTS) {
+	    for(int stepsize=0;stepsize<=2;stepsize++) {
+		AeStepper<> s;
+		s.reset(-1);
+		RefStepper ref;
+		for(int i=0;i<RUN;i++) {
+		    int got = s.advance(mode, n, stepsize);
+		    ref.advance(mode, n, stepsize);
+		    CHECK(got == ref.index && got == s.index, "mode %d steps %d stepsize %d advance %d: got %d, expected %d", mode, n, stepsize, i, got, ref.index);
+		}
+	    }
+	}
+    }
+}
+
+//changing the stepsize mid-run (like QuadSeq's probability control)
+static void testMixedStepsizes() {
+    for(int n : STEP_COUNTS) {
+	AeStepper<> s;
+	s.reset(-1);
+	RefStepper ref;
+	for(int i=0;i<RUN;i++) {
+	    int stepsize = (i * 7) % 3;
+	    s.advance(AE_ALTERNATING, n, stepsize);
+	    ref.advance(AE_ALTERNATING, n, stepsize);
+	    CHECK(s.index == ref.index, "alternating steps %d advance %d: got %d, expected %d", n, i, s.index, ref.index);
+	}
+    }
+}
+
+static void testRandomNeighbour() {
+    for(int n : STEP_COUNTS) {
+	for(int stepsize=0;stepsize<=2;stepsize++) {
+	    AeStepper<> s;
+	    s.reset(-1);
+	    int last = -1;
+	    for(int i=0;i<RUN;i++) {
+		int got = s.advance(AE_RANDOM_NEIGHBOUR, n, stepsize);
+		CHECK(got >= 0 && got < n, "random neighbour steps %d: index %d out of range", n, got);
+		if(last >= 0 && n > 1) {
+		    int d = (got - last + n) % n;
+		    CHECK(d == stepsize % n || d == (n - stepsize % n) % n, "random neighbour steps %d stepsize %d: moved from %d to %d", n, stepsize, last, got);
+		}
+		last = got;
+	    }
+	}
+    }
+}
+
+static void testRandom() {
+    for(int n : STEP_COUNTS) {
+	AeStepper<> s;
+	s.reset(-1);
+	int hits[8] = {};
+	for(int i=0;i<100*n;i++) {
+	    int got = s.advance(AE_RANDOM, n, 1);
+	    CHECK(got >= 0 && got < n, "random steps %d: index %d out of range", n, got);
+	    if(got >= 0 && got < n)
+		hits[got]++;
+	}
+	for(int k=0;k<n;k++)
+	    CHECK(hits[k] > 0, "random steps %d: step %d never played", n, k);
+    }
+}
+
+static void testHold() {
+    AeStepper<> s;
+    s.reset(-1);
+    CHECK(s.advance(AE_HOLD, 8) == 0, "hold after reset should play the first step");
+    s.reset(5);
+    for(int stepsize=0;stepsize<=2;stepsize++)
+	CHECK(s.advance(AE_HOLD, 8, stepsize) == 5, "hold should keep the step");
+    CHECK(s.advance(AE_HOLD, 3) == 2, "hold should clamp to a shorter sequence");
+    CHECK(s.advance(AE_HOLD, 1) == 0, "hold with one step");
+}
+
+static void testModeSets() {
+    //modes outside the set (or out of range) play forward
+    AeStepper<AE_FORWARD_ONLY> f;
+    AeStepper<> a;
+    a.reset(-1);
+    f.reset(-1);
+    for(int i=0;i<RUN;i++) {
+	int stepsize = (i % 3) ? 1 : 2;
+	int got = f.advance(AE_BACKWARD, 5, stepsize);
+	CHECK(got == a.advance(AE_NUM_PLAYBACK_MODES, 5, stepsize), "forward only stepper advance %d: got %d", i, got);
+    }
+}
+
+int main() {
+    testDeterministic();
+    testMixedStepsizes();
+    testRandomNeighbour();
+    testRandom();
+    testHold();
+    testModeSets();
+    if(failures) {
+	printf("%d failures\n", failures);
+	return EXIT_FAILURE;
+    }
+    printf("AeStepper: all tests passed\n");
+    return EXIT_SUCCESS;
+}
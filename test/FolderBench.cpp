@@ -0,0 +1,103 @@
+#include "AeFold.hpp"
+#include <stdio.h>
+#include <chrono>
+
+/* Times Folder's fold and saturation: the old per-sample path (the fold3
+   stages and libm tanh on one sample at a time) against aeFoldBlock() on
+   the oversampled block of each quality tier. Build it with Rack's flags,
+   see the Makefile */
+
+#define BUF_LEN 32
+#define STAGES 3
+#define RUNS 10
+#define BLOCKS 20000
+
+static float fold3(float in, float t) {
+    if(in > t)
+	return t - (in - t);
+    else if(in < -t)
+	return -t + (-t - in);
+    return in;
+}
+
+//noinline, so the per-sample path isn't vectorized over the block by the caller
+__attribute__((noinline)) static float foldSample(float x, float t) {
+    for(int s=0;s<STAGES*2;s++) {
+	x = fold3(x, t);
+    }
+    return tanh(x);
+}
+
+static void perSample(float *x, int len, float t) {
+    for(int i=0;i<len;i++) {
+	x[i] = foldSample(x[i], t);
+    }
+}
+
+static void block(float *x, int len, float t) {
+    aeFoldBlock(x, len, t, STAGES*2);
+}
+
+//fills the block with a sine sweeping over the whole folding range (gain 14)
+static void fill(float *x, int len, int n) {
+    for(int i=0;i<len;i++) {
+	x[i] = 14.0f * sinf(0.01f * (n * len + i));
+    }
+}
+
+//best time per block in ns
+static double bench(void (*f)(float*, int, float), int len, float *sum) {
+    float x[8*BUF_LEN];
+    double best = 1e30;
+    for(int r=0;r<RUNS;r++) {
+	double elapsed = 0.0;
+	for(int n=0;n<BLOCKS;n++) {
+	    fill(x, len, n);
+	    std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+	    f(x, len, 1.0f);
+	    elapsed += std::chrono::duration<double, std::nano>(std::chrono::high_resolution_clock::now() - start).count();
+	    *sum += x[n % len];
+	}
+	best = fmin(best, elapsed / BLOCKS);
+    }
+    return best;
+}
+
+int main() {
+    const struct {
+	const char *name;
+	int factor;
+    } tiers[] = {
+	{"ADAA (fold only)", 1},
+	{"2x Oversampling", 2},
+	{"4x Oversampling", 4},
+	{"8x Oversampling", 8}
+    };
+
+    //both paths must agree within the error of aeTanh
+    float maxError = 0.0f;
+    for(int n=0;n<100;n++) {
+	float a[8*BUF_LEN], b[8*BUF_LEN];
+	fill(a, 8*BUF_LEN, n);
+	fill(b, 8*BUF_LEN, n);
+	perSample(a, 8*BUF_LEN, 1.0f);
+	block(b, 8*BUF_LEN, 1.0f);
+	for(int i=0;i<8*BUF_LEN;i++) {
+	    maxError = fmaxf(maxError, fabsf(a[i] - b[i]));
+	}
+    }
+    printf("max difference %g\n", maxError);
+
+    float sum = 0.0f;
+    printf("%-18s %8s %14s %14s %8s\n", "tier", "samples", "per sample ns", "block ns", "ratio");
+    for(const auto &tier : tiers) {
+	int len = tier.factor * BUF_LEN;
+	double tSample = bench(perSample, len, &sum);
+	double tBlock = bench(block, len, &sum);
+	printf("%-18s %8d %14.1f %14.1f %7.1fx\n", tier.name, len, tSample, tBlock, tSample / tBlock);
+    }
+    //keeps the results alive
+    if(sum == 12345.0f)
+	printf("%g\n", sum);
+    return maxError < 2e-4f ? 0 : 1;
+}
@@ -0,0 +1,18 @@
+/* Just enough of Rack for the standalone tests */
+#pragma once
+#include <algorithm>
+
+namespace rack {
+
+inline int clamp(int x, int a, int b) {
+    return std::min(std::max(x, a), b);
+}
+
+//deterministic, so failures can be reproduced
+inline float randomUniform() {
+    static unsigned int state = 1;
+    state = state * 1664525u + 1013904223u;
+    return (state >> 8) / 16777216.0f;
+}
+
+}